@@ -20,13 +20,26 @@
  * IN THE SOFTWARE.
  */
 
+#include <assert.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "./allocator_interface.h"
+#include "./config.h"
 #include "./memlib.h"
 
+#if THREADS
+#include <pthread.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 // Don't call libc malloc!
 #define malloc(...) (USE_MY_MALLOC)
 #define free(...) (USE_MY_FREE)
@@ -39,6 +52,45 @@
 #endif
 
 
+#if THREADS
+// Protects mem_sbrk and the ownership of the top of the heap. It is only
+// taken with an arena lock held, after it.
+pthread_mutex_t top_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//Bumped by my_init; a thread cache from an older generation holds stale pointers
+uint64_t heap_generation = 1;
+#endif
+
+__attribute__((always_inline))
+static void lock_top_of_heap(void) {
+#if THREADS
+  pthread_mutex_lock(&top_lock);
+#endif
+}
+
+__attribute__((always_inline))
+static void unlock_top_of_heap(void) {
+#if THREADS
+  pthread_mutex_unlock(&top_lock);
+#endif
+}
+
+/*
+The arenas hand out the memory up to heap_top. Past it, up to the break of
+memlib, lies the reserve of the heap: memory that mem_sbrk already handed
+out but no arena has used yet. Growing the heap bumps heap_top through the
+reserve, and only calls mem_sbrk once the reserve runs out, for a whole
+number of TOP_PAGE_SIZE pages. The variables below are protected by top_lock.
+*/
+char *heap_top;
+
+//first byte of the reserve, or heap_top, that memlib had never handed out
+char *heap_fresh_lo;
+
+//bytes that the last call of mem_sbrk grew the heap by
+size_t heap_growth;
+
+
 //Bin Lists
 struct free_list_t {
   struct free_list_t *prev;
@@ -46,6 +98,14 @@ struct free_list_t {
 };
 typedef struct free_list_t free_list_t;
 
+//Nodes of the size-ordered tree of large free blocks, see tree_insert
+struct tree_node_t {
+  struct tree_node_t *left;
+  struct tree_node_t *right;
+  struct tree_node_t *parent;
+};
+typedef struct tree_node_t tree_node_t;
+
 
 //header
 struct header_t {
@@ -54,22 +114,383 @@ struct header_t {
 };
 typedef struct header_t header_t;
 
+// Sizes are multiples of 8, so the low bits of header_t.size hold flags.
+#define SIZE_FLAGS 7u
+// Set on a huge block, whose size is kept in a 64-bit word after the header
+#define HUGE_FLAG 1u
+// Set on a block that my_realloc has grown
+#define GROWN_FLAG 2u
+// Set on a block while my_free_batch is freeing it
+#define BATCH_FLAG 4u
+// Set in prev_size when the previous block is huge; its size does not fit
+#define PREV_HUGE 2u
+
+// Requests of at least HUGE_MIN_SIZE bytes get a huge block. Boundary-tag
+// blocks are kept smaller, which lets their sizes be computed in an int.
+// Must be at most 2^29.
+#ifndef HUGE_MIN_SIZE
+#define HUGE_MIN_SIZE (1 << 29)
+#endif
+
+// Percentage of extra room given to a block that realloc has grown before
+// when it has to be moved to grow again (0 disables)
+#ifndef REALLOC_HEADROOM
+#define REALLOC_HEADROOM 100
+#endif
+
 // The smallest aligned size that will hold a size_t value.
 #define SIZE_T_SIZE align(sizeof(size_t))
 
+// Selects the bin layout at compile time:
+//   0 - one bin per power of two (the original layout)
+//   1 - two-level segregated fit (TLSF): a first level per power of two,
+//       each split into 2^TLSF_SL_LOG2 linear second-level bins
+#ifndef TLSF
+#define TLSF 0
+#endif
+
+#define SMALLEST_BLOCK_SIZE 24
+
+// Requests of at most SLAB_MAX_SIZE bytes are served from header-free slab
+// runs instead of the boundary-tag heap. Set to 0 to disable slabs.
+#ifndef SLAB_MAX_SIZE
+#define SLAB_MAX_SIZE 32
+#endif
+
+// Size in bytes of a slab run. Must be a power of two.
+#ifndef SLAB_RUN_SIZE
+#define SLAB_RUN_SIZE 1024
+#endif
+
+// Freed blocks with at most QUICK_MAX_SIZE usable bytes are kept on per-size
+// quick lists without being coalesced, and reused for requests of exactly
+// their size. They are coalesced in address order when more than QUICK_LIMIT
+// of them are deferred or when a request misses the bins. This trades
+// utilization for fewer header updates; 0 (the default) coalesces on every free.
+#ifndef QUICK_MAX_SIZE
+#define QUICK_MAX_SIZE 0
+#endif
+
+#ifndef QUICK_LIMIT
+#define QUICK_LIMIT 64
+#endif
+
+// Free blocks of at least TREE_MIN_SIZE bytes, header included, are kept in
+// a tree ordered by size instead of the bins, and allocated best-fit. Must be
+// a power of two of at least 32; 0 keeps every block in the bins.
+#ifndef TREE_MIN_SIZE
+#define TREE_MIN_SIZE 4096
+#endif
+
+#if TLSF
+
+// Number of second-level subdivisions per power of two is 2^TLSF_SL_LOG2
+#ifndef TLSF_SL_LOG2
+#define TLSF_SL_LOG2 3
+#endif
+
+#define SL_COUNT (1 << TLSF_SL_LOG2)
+
+// A request looks at no more than TLSF_FIT_LIMIT blocks of its own bin before
+// it takes the head of the next non-empty bin, which always fits, so a lookup
+// is bounded however long the bin grows
+#ifndef TLSF_FIT_LIMIT
+#define TLSF_FIT_LIMIT 8
+#endif
+
+// Sizes below 2^FL_SHIFT all live in first level 0, in bins ALIGNMENT apart
+#define FL_SHIFT (TLSF_SL_LOG2 + 3)
+
+#define FL_COUNT (32 - FL_SHIFT + 1)
+
+#define BIN_SIZE (FL_COUNT * SL_COUNT)
+
+#else
+
 //Bins where max and min size are powers of two
 #define MIN_SIZE 5
 
 #define SIZE_LIMIT 32
 
-#define SMALLEST_BLOCK_SIZE 24
-
 #define BIN_SIZE SIZE_LIMIT - MIN_SIZE
 
 #define BIN_OFFSET SIZE_LIMIT - MIN_SIZE - 1
 
+#endif
+
+
+#if SLAB_MAX_SIZE
+#define SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT)
+
+struct slab_run_t;
+#endif
+
+#define QUICK_CLASSES (QUICK_MAX_SIZE / ALIGNMENT + 1)
+
+// Number of arenas. Each arena has its own bins, slab runs and lock, and
+// threads are assigned to them round-robin. At most 256.
+#ifndef ARENAS
+#if THREADS
+#define ARENAS 8
+#else
+#define ARENAS 1
+#endif
+#endif
+
+// When an arena takes over the top of the heap from another one, its new
+// memory starts on an ARENA_CHUNK_SIZE boundary and it grabs at least
+// ARENA_CHUNK_SIZE bytes. Must be a power of two.
+#ifndef ARENA_CHUNK_SIZE
+#define ARENA_CHUNK_SIZE 4096
+#endif
+
+// The heap grows in multiples of TOP_PAGE_SIZE bytes (default ALIGNMENT),
+// and by at least TOP_PAD_PERCENT percent of its size but never by more
+// than the last time it grew (default 0). The memory past what was asked
+// for is kept in reserve for the next growth. The defaults grow the heap
+// by exactly what is missing, since memory left in reserve when a program
+// ends counts against its utilization. Must be a power of two.
+#ifndef TOP_PAGE_SIZE
+#define TOP_PAGE_SIZE ALIGNMENT
+#endif
+
+#ifndef TOP_PAD_PERCENT
+#define TOP_PAD_PERCENT 0
+#endif
+
+// Once a free block of at least TRIM_THRESHOLD bytes reaches the top of the
+// heap, free gives it back to memlib (default 128 KB with MEM_MMAP, where
+// memlib returns it to the system, and 0 otherwise, which disables it)
+#ifndef TRIM_THRESHOLD
+#if MEM_MMAP
+#define TRIM_THRESHOLD (128 * 1024)
+#else
+#define TRIM_THRESHOLD 0
+#endif
+#endif
+
+// Free bytes that trimming leaves at the top of the heap (default half of
+// TRIM_THRESHOLD)
+#ifndef TRIM_PAD
+#define TRIM_PAD (TRIM_THRESHOLD / 2)
+#endif
+
+// The scavenger thread that my_scavenger_start runs gives back the pages
+// inside free blocks of at least SCAVENGE_MIN_SIZE bytes (default 16 KB)
+// that have been free for SCAVENGE_DECAY_MS milliseconds (default 0, which
+// leaves it out). Needs THREADS and MEM_MMAP.
+#ifndef SCAVENGE_DECAY_MS
+#define SCAVENGE_DECAY_MS 0
+#endif
+
+#ifndef SCAVENGE_MIN_SIZE
+#define SCAVENGE_MIN_SIZE (16 * 1024)
+#endif
+
+#if SCAVENGE_DECAY_MS && !(THREADS && MEM_MMAP)
+#error "SCAVENGE_DECAY_MS needs THREADS=1 and MEM_MMAP=1"
+#endif
+
+//a free block needs room for the epoch past its links
+#if SCAVENGE_DECAY_MS && SCAVENGE_MIN_SIZE < 64
+#error "SCAVENGE_MIN_SIZE must be at least 64"
+#endif
+
+// 1 keeps the counters that my_malloc_stats reports (default 0)
+#ifndef STATS
+#define STATS 0
+#endif
+
+// Average number of bytes allocated between two samples of the heap profile
+// that my_malloc_profile writes (default 0, which disables sampling)
+#ifndef PROFILE_SAMPLE_BYTES
+#define PROFILE_SAMPLE_BYTES 0
+#endif
+
+/*
+An arena is an independent heap: every block lives in the memory of exactly
+one arena and is only ever linked into that arena's bins. The memory of an
+arena is a set of runs of the shared heap. The block after the last block
+of a run that is not at the top of the heap is an allocated block of size 0,
+so blocks never coalesce across arenas.
+*/
+struct arena_t {
+  free_list_t *bin[BIN_SIZE];
+#if TREE_MIN_SIZE
+  tree_node_t *tree;
+#endif
+#if TLSF
+  //First-level bitmap: bit fl is set iff sl_map[fl] is not zero
+  uint32_t fl_map;
+
+  //Second-level bitmaps: bit sl of sl_map[fl] is set iff bin[fl * SL_COUNT + sl] is not empty
+  uint32_t sl_map[FL_COUNT];
+#else
+  //Occupancy bitmap of the bins: bit i is set iff bin[i] is not empty
+  uint32_t bin_map;
+#endif
+#if SLAB_MAX_SIZE
+  //runs of each size class with at least one free slot
+  struct slab_run_t *slab_partial[SLAB_CLASSES];
+#endif
+#if QUICK_MAX_SIZE
+  //quick[i] lists deferred blocks of size i * ALIGNMENT through their next field
+  free_list_t *quick[QUICK_CLASSES];
+  uint32_t quick_count;
+#endif
+  //free huge blocks, linked through the pointers handed out for them
+  free_list_t *huge;
+  //the pending block that follows the newest run of the arena. It is the
+  //top of the heap for as long as no other arena has grown the heap since.
+  char *top;
+  //the first byte of the memory that the current my_calloc got from mem_sbrk
+  //and that was never used before, see note_fresh
+  char *fresh;
+#if STATS
+  //counters of the heap operations of the arena, by size class of the
+  //block that was split or produced by coalescing, see my_malloc_stats
+  uint64_t splits[MALLOC_STATS_CLASSES];
+  uint64_t coalesces[MALLOC_STATS_CLASSES];
+  uint64_t sbrk_calls;
+  uint64_t sbrk_bytes;
+#endif
+#if THREADS
+  pthread_mutex_t lock;
+
+  //blocks freed by threads of other arenas, see remote_push
+  struct remote_block_t *remote_free;
+#endif
+};
+typedef struct arena_t arena_t;
+
+#if THREADS
+arena_t arenas[ARENAS] = {[0 ... ARENAS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+#else
+arena_t arenas[ARENAS];
+#endif
+
+#if ARENAS > 1
+//hands out arenas to threads round-robin
+uint32_t next_arena;
+
+static __thread arena_t *thread_arena;
+#endif
+
+//----------Page map
+
+// The page map is kept for the arenas of blocks and for the classes of slab
+// objects, and is left out when neither is needed
+#define PAGE_MAP (ARENAS > 1 || SLAB_MAX_SIZE)
+
+#if PAGE_MAP
+
+#if ARENAS > 1 && ARENA_CHUNK_SIZE % SLAB_RUN_SIZE
+#error "ARENA_CHUNK_SIZE must be a multiple of SLAB_RUN_SIZE"
+#endif
+
+// Pages per leaf of the page map; a power of two
+#define PAGE_MAP_LEAF_SIZE 512
+
+// Leaves that cover the largest heap, with room for the page it may
+// straddle and for its last arena chunk
+#define PAGE_MAP_LEAVES (MEM_LIMIT / SLAB_RUN_SIZE / PAGE_MAP_LEAF_SIZE + 2)
+
+/*
+Describes a SLAB_RUN_SIZE page of the heap: the arena that owns its memory
+and, if the page is a slab run, the class of its objects plus one, or 0. A
+free reads the arena and the class of a slab object from here, without
+touching the memory around the object.
+*/
+struct page_t {
+  uint8_t arena;
+  uint8_t slab_class;
+};
+typedef struct page_t page_t;
+
+/*
+The page map is a two-level radix tree on the page number from page_base:
+the root points to leaves of PAGE_MAP_LEAF_SIZE pages. A leaf is installed
+when the heap first grows into it, under top_lock, so the map touches as
+much memory as the heap has grown rather than the range it may span.
+Lookups never take a lock: a thread only looks up memory that was handed to
+it after the leaf was published.
+*/
+page_t *page_map[PAGE_MAP_LEAVES];
+
+page_t page_leaves[PAGE_MAP_LEAVES][PAGE_MAP_LEAF_SIZE];
+
+//number of leaves installed in page_map
+uint32_t page_leaves_used;
+
+//number of the first SLAB_RUN_SIZE page that can hold heap memory
+uint64_t page_base;
+
+//Gets the entry of the page that contains ptr
+__attribute__((always_inline))
+static page_t *get_page(void *ptr) {
+  uint64_t page = (uint64_t) ptr / SLAB_RUN_SIZE - page_base;
+  page_t *leaf = __atomic_load_n(&page_map[page / PAGE_MAP_LEAF_SIZE], __ATOMIC_ACQUIRE);
+  return &leaf[page % PAGE_MAP_LEAF_SIZE];
+}
+
+//Installs the leaves for the heap up to end, which is its new top
+static void page_map_grow(char *end) {
+  uint64_t last = ((uint64_t) end - 1) / SLAB_RUN_SIZE - page_base;
+  while (page_leaves_used <= last / PAGE_MAP_LEAF_SIZE) {
+    __atomic_store_n(&page_map[page_leaves_used], page_leaves[page_leaves_used], __ATOMIC_RELEASE);
+    ++page_leaves_used;
+  }
+}
+
+//Empties the page map for a new heap. No other call may run at the same time.
+static void page_map_reset(void) {
+  memset(page_leaves, 0, page_leaves_used * sizeof(page_leaves[0]));
+  memset(page_map, 0, page_leaves_used * sizeof(page_map[0]));
+  page_leaves_used = 0;
+  page_base = (uint64_t) my_heap_lo() / SLAB_RUN_SIZE;
+}
+
+#endif
+
+//----------End of page map
+
+__attribute__((always_inline))
+static void lock_arena(arena_t *a) {
+#if THREADS
+  pthread_mutex_lock(&a->lock);
+#endif
+}
+
+__attribute__((always_inline))
+static void unlock_arena(arena_t *a) {
+#if THREADS
+  pthread_mutex_unlock(&a->lock);
+#endif
+}
+
+//Gets the arena of the calling thread
+__attribute__((always_inline))
+static arena_t *get_thread_arena(void) {
+#if ARENAS > 1
+  if (thread_arena == NULL) {
+    thread_arena = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % ARENAS];
+  }
+  return thread_arena;
+#else
+  return &arenas[0];
+#endif
+}
 
-free_list_t *bin[BIN_SIZE];
+//Gets the arena that owns the block or slab object ptr
+__attribute__((always_inline))
+static arena_t *get_arena(void *ptr) {
+#if ARENAS > 1
+  return &arenas[get_page(ptr)->arena];
+#else
+  (void) ptr;
+  return &arenas[0];
+#endif
+}
 
 __attribute__((always_inline))
 static int align(int size) {
@@ -86,10 +507,30 @@ static int min(int a, int b) {
    return (a > b)? b : a;
 }
 
+#if STATS
+//Gets the size class of my_malloc_stats that holds blocks of size usable bytes
+__attribute__((always_inline))
+static int stats_class(uint64_t size) {
+  int k = size <= 1 ? 0 : 64 - __builtin_clzll(size - 1);
+  return k < MALLOC_STATS_CLASSES ? k : MALLOC_STATS_CLASSES - 1;
+}
+#endif
+
 //Gets teh size of the block pointed to by ptr
 __attribute__((always_inline))
-static uint32_t get_size(void *ptr) {
-  return ((header_t *) ((uint64_t) ptr - SIZE_T_SIZE))->size;
+static size_t get_size(void *ptr) {
+  header_t *header = (header_t *) ((uint64_t) ptr - SIZE_T_SIZE);
+  if (__builtin_expect(header->size & HUGE_FLAG, 0)) {
+    return *(uint64_t *) ptr & ~(uint64_t) SIZE_FLAGS;
+  }
+  return header->size & ~SIZE_FLAGS;
+}
+
+//Returns whether the block at ptr is huge. ptr may be the block or the
+//pointer handed out for it, but not a slab object.
+__attribute__((always_inline))
+static int is_huge(void *ptr) {
+  return ((header_t *) ((uint64_t) ptr - SIZE_T_SIZE))->size & HUGE_FLAG;
 }
 
 //Gets the size of the block before the one pointed to by ptr
@@ -99,12 +540,26 @@ static uint32_t get_prev_size(void *ptr) {
 }
 
 
-//Sets teh size of the block at ptr to new_size
+//Sets teh size of the block at ptr to new_size, clearing its flags
 __attribute__((always_inline))
 static void set_size(void *ptr, int new_size) {
   ((header_t *) ((uint64_t)ptr - SIZE_T_SIZE))->size = new_size;
 }
 
+#if REALLOC_HEADROOM
+//Returns whether realloc has grown the block at ptr before
+__attribute__((always_inline))
+static int is_grown(void *ptr) {
+  return ((header_t *) ((uint64_t)ptr - SIZE_T_SIZE))->size & GROWN_FLAG;
+}
+#endif
+
+//Records that realloc has grown the block at ptr
+__attribute__((always_inline))
+static void mark_grown(void *ptr) {
+  ((header_t *) ((uint64_t)ptr - SIZE_T_SIZE))->size |= GROWN_FLAG;
+}
+
 //Sets the block at ptr of size size free
 static void mark_free(void *ptr, int size) {
    ((header_t *)((uint64_t)ptr + size))->prev_size = size + 1;
@@ -117,9 +572,56 @@ static void mark_not_free(void *ptr, int size) {
 
 //Gets the index in the bin of the free list that would contain a block
 //of size size
+#if TLSF
+static int get_bin(int size) {
+  if (size < (1 << FL_SHIFT)) {
+    return size >> 3;
+  }
+  int fls = 31 - __builtin_clz((uint32_t) size);
+  int fl = fls - FL_SHIFT + 1;
+  int sl = (size >> (fls - TLSF_SL_LOG2)) ^ SL_COUNT;
+  return (fl << TLSF_SL_LOG2) | sl;
+}
+#else
 static int get_bin(int size) {
    return min(SIZE_LIMIT - 1, max(0, BIN_OFFSET - __builtin_clz((uint32_t) size)));
 }
+#endif
+
+//Marks bin[bin_index] of arena a as non-empty in the occupancy bitmap
+__attribute__((always_inline))
+static void bin_map_set(arena_t *a, int bin_index) {
+#if TLSF
+  int fl = bin_index >> TLSF_SL_LOG2;
+  a->sl_map[fl] |= 1u << (bin_index & (SL_COUNT - 1));
+  a->fl_map |= 1u << fl;
+#else
+  a->bin_map |= 1u << bin_index;
+#endif
+}
+
+//Marks bin[bin_index] of arena a as empty in the occupancy bitmap
+__attribute__((always_inline))
+static void bin_map_clear(arena_t *a, int bin_index) {
+#if TLSF
+  int fl = bin_index >> TLSF_SL_LOG2;
+  a->sl_map[fl] &= ~(1u << (bin_index & (SL_COUNT - 1)));
+  if (a->sl_map[fl] == 0) {
+    a->fl_map &= ~(1u << fl);
+  }
+#else
+  a->bin_map &= ~(1u << bin_index);
+#endif
+}
+
+//Returns 1 if bin[bin_index] of arena a is marked non-empty in the occupancy bitmap
+static uint8_t bin_map_test(arena_t *a, int bin_index) {
+#if TLSF
+  return (a->sl_map[bin_index >> TLSF_SL_LOG2] >> (bin_index & (SL_COUNT - 1))) & 1;
+#else
+  return (a->bin_map >> bin_index) & 1;
+#endif
+}
 
 
 /*
@@ -147,117 +649,487 @@ Requires that a next block exists
 
 Effect:
 Returns 1 if the next block is free
-Returns 0 if no next block exists or the next block is not free
+Returns 0 if the next block is not free
 */
 __attribute__((always_inline))
 static uint8_t is_free_forward(void *ptr) {
   int curr_size = get_size(ptr) + SIZE_T_SIZE;
+  if (is_huge(ptr + curr_size)) {
+    return 0;
+  }
   int next_size = get_size(ptr + curr_size);
   header_t *next_header = (header_t *) ((uint64_t) ptr + curr_size + next_size);
   return next_header->prev_size & 1;
 }
 
 
-
-//-----Testing functions: run with -c to check after every heap operation------------
-
 /*
-returns 1 if block pointed to by ptr is free, or 0 otherwsie
+Returns 1 if another block follows the block at ptr of size size, or 0 if
+it is the last block before the top of its arena a.
 */
 __attribute__((always_inline))
-static uint8_t is_free(void *ptr) {
-   return ((header_t *)((uint64_t) ptr + get_size(ptr)))->prev_size & 1;
+static uint8_t has_next(arena_t *a, void *ptr, size_t size) {
+  return (char *) ptr + size + SIZE_T_SIZE != a->top;
 }
 
-/*
-returns 1 if all blocks that should be coalesced are coalesced or 0 otherwise
-The invariant it checks for is that there are no two conscutive free blocks
-*/
-static uint8_t check_coalesce(void) {
-  free_list_t *free_list;
-  int size;
-  for (int i = 0; i < BIN_SIZE; ++i) {
-    for (free_list = bin[i]; free_list != NULL; free_list = free_list->next) {
-      size = get_size(free_list);
-      if ((uint64_t) my_heap_hi() > ((uint64_t) free_list + size + SIZE_T_SIZE) && is_free_forward(free_list)) {
-        return 0;
-      }
-      if ((uint64_t) my_heap_lo() < ((uint64_t) free_list - SIZE_T_SIZE) && is_free_back(free_list)) {
-        return 0;
-      }
-    }
+
+#if SCAVENGE_DECAY_MS
+//ticks every SCAVENGE_DECAY_MS milliseconds, see scavenge
+uint64_t scavenge_epoch = 1;
+
+//Gets the word of the free block whose links start at node that holds the
+//epoch in which the block was freed, or UINT64_MAX once its pages are released
+__attribute__((always_inline))
+static uint64_t *free_epoch(void *node) {
+  return (uint64_t *) ((char *) node + sizeof(tree_node_t));
+}
+
+//Records the current epoch in the free block of size size whose links start
+//at node, if the scavenger looks at blocks of its size
+__attribute__((always_inline))
+static void stamp_free(void *node, size_t size) {
+  if (size >= SCAVENGE_MIN_SIZE) {
+    *free_epoch(node) = __atomic_load_n(&scavenge_epoch, __ATOMIC_RELAXED);
   }
-  return 1;
 }
+#endif
+
+
+//----------Huge blocks
 
 /*
-returns 1 if  all blocks on the free list are marked free or 0 otherwise
+A huge block has a 64-bit size. Its header_t only carries HUGE_FLAG in
+size; the size itself, with HUGE_FLAG set too, is the first word of the
+block, and the pointer handed out is one word further. The header read
+before that pointer then also has HUGE_FLAG set, which is how the entry
+points tell huge blocks apart. The block after a huge one has PREV_HUGE
+in prev_size instead of the size.
+
+Neighbours never merge with a huge block. A freed huge block goes onto the
+huge list of its arena, and so does a boundary-tag block that coalescing
+grows to HUGE_MIN_SIZE, which keeps boundary-tag sizes within an int. Huge
+requests take the best fit from the list, and other requests carve their
+block off the front of a free huge block before the heap grows.
 */
-static uint8_t check_all_free(void) {
-  free_list_t *free_list;
-  for (int i = 0; i < BIN_SIZE; ++i) {
-    for (free_list = bin[i]; free_list != NULL; free_list = free_list->next) {
-      if (is_free(free_list) == 0)
-         return 0;
-    }
-  }
-  return 1;
+
+//Makes the block at ptr a huge block of size size
+__attribute__((always_inline))
+static void set_huge(void *ptr, size_t size) {
+  ((header_t *) ((uint64_t) ptr - SIZE_T_SIZE))->size = HUGE_FLAG;
+  *(uint64_t *) ptr = size | HUGE_FLAG;
+  ((header_t *) ((uint64_t) ptr + size))->prev_size = PREV_HUGE;
 }
 
-// check - This checks our invariant that the size_t header before every
-// block points to either the beginning of the next block, or the end of the
-// heap.
-int my_check(void) {
-  char* p;
-  char* lo = (char*)mem_heap_lo();
-  char* hi = (char*)mem_heap_hi() + 1;
-  size_t size = 0;
+//Gets the size of the huge block that holds a request of size bytes
+__attribute__((always_inline))
+static size_t huge_block_size(size_t size) {
+  return ((size + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1)) + SIZE_T_SIZE;
+}
 
-  p = lo;
-  while (lo <= p && p + SIZE_T_SIZE < hi) {
-    size = align(((header_t *) p)->size + SIZE_T_SIZE);
-    p += size;
+//Returns 1 if a free block of size bytes, not counting its header, has to
+//be a huge block, or 0 if it stays a boundary-tag block
+__attribute__((always_inline))
+static int is_huge_size(size_t size) {
+  return size >= HUGE_MIN_SIZE;
+}
+
+//Adds the free huge block handed out as ptr to the huge list of arena a
+static void huge_push(arena_t *a, free_list_t *ptr) {
+#if SCAVENGE_DECAY_MS
+  stamp_free(ptr, get_size((char *) ptr - SIZE_T_SIZE));
+#endif
+  ptr->prev = NULL;
+  ptr->next = a->huge;
+  if (a->huge != NULL) {
+    a->huge->prev = ptr;
   }
+  a->huge = ptr;
+}
 
-  if (p + SIZE_T_SIZE != hi) {
-    printf("Bad headers did not end at heap_hi!\n");
-    printf("heap_lo: %lu, heap_hi: %lu, size: %lu, p: %lu\n", (uint64_t) lo, (uint64_t) hi, size, (uint64_t) p);
-    return -1;
+//Removes the huge block handed out as ptr from the huge list of arena a
+static void huge_remove(arena_t *a, free_list_t *ptr) {
+  if (ptr->prev != NULL) {
+    ptr->prev->next = ptr->next;
+  } else {
+    a->huge = ptr->next;
   }
-   
-  if (check_all_free() == 0) {
-    printf("some blocks on the free list are not marked free\n");
-    return -1;
+  if (ptr->next != NULL) {
+    ptr->next->prev = ptr->prev;
   }
-
-  if (check_coalesce() == 0) {
-    printf("some blocks on the free list should be coalesced, but are not\n");
-    return -1;
-  }  
-
-  return 0;
 }
-//---------Testing functions end -----------------
-
 
-//---------Free list manipulation functions ---------------
+//----------End of huge blocks
 
-/*
-Given a free_list_t pointer and its index in the bin, 
-deletes the free_list
 
-Args:
-   free_list: a pointer to a free_list_t
-   bin_index: the index in bin of the linked list that contains free_list
+//----------Tree of large free blocks
 
-Effect: free_list gets deleted from the free_list
+#if TREE_MIN_SIZE
 
-Requires free_list be contained in the linked list bin[bin_index]
+/*
+The large free blocks of an arena form a treap keyed on (size, address):
+a binary search tree in that order, and a heap on a priority that is a
+hash of the address. The hash stands in for the random priorities of a
+treap, so the tree is balanced in expectation without any random state,
+and best-fit takes O(log n) steps.
 */
 __attribute__((always_inline))
-static void delete_node(free_list_t *free_list, int bin_index) {
-  free_list_t *next = free_list->next;
-  free_list_t *prev = free_list->prev;
+static uint32_t tree_priority(tree_node_t *node) {
+  return ((uint64_t) node >> 3) * 0x9E3779B97F4A7C15ull >> 32;
+}
+
+//Returns 1 if node x comes before node y in (size, address) order
+__attribute__((always_inline))
+static uint8_t tree_less(tree_node_t *x, tree_node_t *y) {
+  uint32_t x_size = get_size(x);
+  uint32_t y_size = get_size(y);
+  return x_size < y_size || (x_size == y_size && x < y);
+}
+
+//Makes child take the place of old below parent in the tree of arena a
+__attribute__((always_inline))
+static void tree_replace(arena_t *a, tree_node_t *parent, tree_node_t *old, tree_node_t *child) {
+  if (parent == NULL) {
+    a->tree = child;
+  } else if (parent->left == old) {
+    parent->left = child;
+  } else {
+    parent->right = child;
+  }
+  if (child != NULL) {
+    child->parent = parent;
+  }
+}
+
+//Rotates node above its parent in the tree of arena a
+static void tree_rotate_up(arena_t *a, tree_node_t *node) {
+  tree_node_t *parent = node->parent;
+  tree_replace(a, parent->parent, parent, node);
+  if (parent->left == node) {
+    parent->left = node->right;
+    if (node->right != NULL) {
+      node->right->parent = parent;
+    }
+    node->right = parent;
+  } else {
+    parent->right = node->left;
+    if (node->left != NULL) {
+      node->left->parent = parent;
+    }
+    node->left = parent;
+  }
+  parent->parent = node;
+}
+
+//Inserts node into the tree of arena a
+static void tree_insert(arena_t *a, tree_node_t *node) {
+  tree_node_t *parent = NULL;
+  tree_node_t **link = &a->tree;
+  while (*link != NULL) {
+    parent = *link;
+    link = tree_less(node, parent) ? &parent->left : &parent->right;
+  }
+  *link = node;
+  node->parent = parent;
+  node->left = NULL;
+  node->right = NULL;
+
+  uint32_t priority = tree_priority(node);
+  while (node->parent != NULL && priority > tree_priority(node->parent)) {
+    tree_rotate_up(a, node);
+  }
+}
+
+//Removes node from the tree of arena a. It is rotated down until it has at
+//most one child, which takes its place.
+static void tree_delete(arena_t *a, tree_node_t *node) {
+  while (node->left != NULL && node->right != NULL) {
+    if (tree_priority(node->left) > tree_priority(node->right)) {
+      tree_rotate_up(a, node->left);
+    } else {
+      tree_rotate_up(a, node->right);
+    }
+  }
+  tree_replace(a, node->parent, node, node->left != NULL ? node->left : node->right);
+}
+
+//Returns the smallest, and among those the lowest, block of arena a whose
+//size is at least size, or NULL if there is none
+__attribute__((always_inline))
+static free_list_t *tree_best_fit(arena_t *a, uint32_t size) {
+  tree_node_t *best = NULL;
+  tree_node_t *node = a->tree;
+  while (node != NULL) {
+    if (get_size(node) >= size) {
+      best = node;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return (free_list_t *) best;
+}
+
+//Returns 1 if the free block free_list belongs in the tree rather than the bins
+__attribute__((always_inline))
+static uint8_t in_tree(free_list_t *free_list) {
+  return get_size(free_list) + SIZE_T_SIZE >= TREE_MIN_SIZE;
+}
+
+#endif
+
+//----------End of tree of large free blocks
+
+
+//-----Testing functions: run with -c to check after every heap operation------------
+
+/*
+returns 1 if block pointed to by ptr is free, or 0 otherwsie
+*/
+__attribute__((always_inline))
+static uint8_t is_free(void *ptr) {
+   return ((header_t *)((uint64_t) ptr + get_size(ptr)))->prev_size & 1;
+}
+
+/*
+returns 1 if all blocks that should be coalesced are coalesced or 0 otherwise
+The invariant it checks for is that there are no two conscutive free blocks
+*/
+static uint8_t check_coalesce(arena_t *a) {
+  free_list_t *free_list;
+  int size;
+  for (int i = 0; i < BIN_SIZE; ++i) {
+    for (free_list = a->bin[i]; free_list != NULL; free_list = free_list->next) {
+      size = get_size(free_list);
+      if (has_next(a, free_list, size) && is_free_forward(free_list)) {
+        return 0;
+      }
+      if ((uint64_t) my_heap_lo() < ((uint64_t) free_list - SIZE_T_SIZE) && is_free_back(free_list)) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/*
+returns 1 if all blocks on the free lists of arena a are marked free and
+owned by a, or 0 otherwise
+*/
+static uint8_t check_all_free(arena_t *a) {
+  free_list_t *free_list;
+  for (int i = 0; i < BIN_SIZE; ++i) {
+    for (free_list = a->bin[i]; free_list != NULL; free_list = free_list->next) {
+      if (is_free(free_list) == 0 || get_arena(free_list) != a)
+         return 0;
+#if TREE_MIN_SIZE
+      if (in_tree(free_list))
+         return 0;
+#endif
+    }
+  }
+  return 1;
+}
+
+/*
+returns 1 if bin_map has exactly the bits of the non-empty bins set or 0 otherwise
+*/
+static uint8_t check_bin_map(arena_t *a) {
+  for (int i = 0; i < BIN_SIZE; ++i) {
+    if ((a->bin[i] != NULL) != bin_map_test(a, i)) {
+      return 0;
+    }
+  }
+#if TLSF
+  for (int fl = 0; fl < FL_COUNT; ++fl) {
+    if ((a->sl_map[fl] != 0) != ((a->fl_map >> fl) & 1)) {
+      return 0;
+    }
+  }
+#endif
+  return 1;
+}
+
+#if SLAB_MAX_SIZE
+static uint8_t check_slab(arena_t *a);
+static void *malloc_from_free_list(arena_t *a, size_t size);
+#endif
+
+/*
+returns 1 if every block on the huge list of arena a is a huge block owned
+by a and linked back to its predecessor, or 0 otherwise
+*/
+static uint8_t check_huge(arena_t *a) {
+  free_list_t *prev = NULL;
+  for (free_list_t *free_list = a->huge; free_list != NULL; free_list = free_list->next) {
+    if (!is_huge(free_list) || !is_huge((char *) free_list - SIZE_T_SIZE) ||
+        get_size((char *) free_list - SIZE_T_SIZE) < HUGE_MIN_SIZE ||
+        get_arena(free_list) != a || free_list->prev != prev) {
+      return 0;
+    }
+    prev = free_list;
+  }
+  return 1;
+}
+
+#if TREE_MIN_SIZE
+/*
+Checks the subtree at node of the tree of arena a. *prev is the node that
+precedes the subtree in order, or NULL.
+
+returns 1 if every node is a free, fully coalesced large block owned by a,
+the nodes are in strictly increasing (size, address) order and every child
+links back to its parent and has no higher priority than it, or 0 otherwise
+*/
+static uint8_t check_tree(arena_t *a, tree_node_t *node, tree_node_t **prev) {
+  if (node == NULL) {
+    return 1;
+  }
+  if (!check_tree(a, node->left, prev)) {
+    return 0;
+  }
+  int size = get_size(node);
+  if (!is_free(node) || !in_tree((free_list_t *) node) || get_arena(node) != a ||
+      (*prev != NULL && !tree_less(*prev, node)) ||
+      (node->left != NULL && (node->left->parent != node || tree_priority(node->left) > tree_priority(node))) ||
+      (node->right != NULL && (node->right->parent != node || tree_priority(node->right) > tree_priority(node))) ||
+      (has_next(a, node, size) && is_free_forward(node)) ||
+      ((uint64_t) my_heap_lo() < (uint64_t) node - SIZE_T_SIZE && is_free_back(node))) {
+    return 0;
+  }
+  *prev = node;
+  return check_tree(a, node->right, prev);
+}
+#endif
+
+#if QUICK_MAX_SIZE
+/*
+returns 1 if every block on the quick lists of arena a has the size of its
+list, is marked allocated and is owned by a, and quick_count matches, or 0
+otherwise
+*/
+static uint8_t check_quick(arena_t *a) {
+  uint32_t count = 0;
+  for (int i = 0; i < QUICK_CLASSES; ++i) {
+    for (free_list_t *block = a->quick[i]; block != NULL; block = block->next) {
+      if (get_size(block) != i * ALIGNMENT || is_free(block) || get_arena(block) != a) {
+        return 0;
+      }
+      ++count;
+    }
+  }
+  return count == a->quick_count && count <= QUICK_LIMIT;
+}
+#endif
+
+// check_heap - This checks our invariant that the size_t header before every
+// block points to either the beginning of the next block, or the end of the
+// heap.
+static int check_heap(void) {
+  char* p;
+  char* lo = (char*)mem_heap_lo();
+  char* hi = heap_top;
+  size_t size = 0;
+
+  p = lo;
+  while (lo <= p && p + SIZE_T_SIZE < hi) {
+    size = get_size(p + SIZE_T_SIZE) + SIZE_T_SIZE;
+    p += size;
+  }
+
+  if (p + SIZE_T_SIZE != hi) {
+    printf("Bad headers did not end at heap_hi!\n");
+    printf("heap_lo: %lu, heap_hi: %lu, size: %lu, p: %lu\n", (uint64_t) lo, (uint64_t) hi, size, (uint64_t) p);
+    return -1;
+  }
+   
+  for (int i = 0; i < ARENAS; ++i) {
+    arena_t *a = &arenas[i];
+    if (check_all_free(a) == 0) {
+      printf("some blocks on the free list of arena %d are not marked free\n", i);
+      return -1;
+    }
+
+    if (check_coalesce(a) == 0) {
+      printf("some blocks on the free list of arena %d should be coalesced, but are not\n", i);
+      return -1;
+    }
+
+    if (check_bin_map(a) == 0) {
+      printf("bin_map of arena %d does not match the non-empty bins\n", i);
+      return -1;
+    }
+
+    if (check_huge(a) == 0) {
+      printf("the huge list of arena %d is inconsistent\n", i);
+      return -1;
+    }
+
+#if SLAB_MAX_SIZE
+    if (check_slab(a) == 0) {
+      printf("some partial slab runs of arena %d are inconsistent\n", i);
+      return -1;
+    }
+#endif
+
+#if TREE_MIN_SIZE
+    tree_node_t *prev = NULL;
+    if ((a->tree != NULL && a->tree->parent != NULL) || check_tree(a, a->tree, &prev) == 0) {
+      printf("the tree of large free blocks of arena %d is inconsistent\n", i);
+      return -1;
+    }
+#endif
+
+#if QUICK_MAX_SIZE
+    if (check_quick(a) == 0) {
+      printf("the quick lists of arena %d are inconsistent\n", i);
+      return -1;
+    }
+#endif
+  }
+
+  return 0;
+}
+int my_check(void) {
+  for (int i = 0; i < ARENAS; ++i) {
+    lock_arena(&arenas[i]);
+  }
+  lock_top_of_heap();
+  int result = check_heap();
+  unlock_top_of_heap();
+  for (int i = ARENAS - 1; i >= 0; --i) {
+    unlock_arena(&arenas[i]);
+  }
+  return result;
+}
+//---------Testing functions end -----------------
+
+
+//---------Free list manipulation functions ---------------
+
+/*
+Given a free_list_t pointer and its index in the bin of arena a,
+deletes the free_list
+
+Args:
+   a: the arena that owns free_list
+   free_list: a pointer to a free_list_t
+   bin_index: the index in bin of the linked list that contains free_list
+
+Effect: free_list gets deleted from the free_list
+
+Requires free_list be contained in the linked list a->bin[bin_index], or
+in the tree of a if it is a large block
+*/
+__attribute__((always_inline))
+static void delete_node(arena_t *a, free_list_t *free_list, int bin_index) {
+#if TREE_MIN_SIZE
+  if (in_tree(free_list)) {
+    tree_delete(a, (tree_node_t *) free_list);
+    return;
+  }
+#endif
+  free_list_t *next = free_list->next;
+  free_list_t *prev = free_list->prev;
 
   if (next != NULL) {
     next->prev = prev;
@@ -266,8 +1138,67 @@ static void delete_node(free_list_t *free_list, int bin_index) {
     prev->next = next;
   }
   else {
-    bin[bin_index] = next;
+    a->bin[bin_index] = next;
+    if (next == NULL) {
+      bin_map_clear(a, bin_index);
+    }
+  }
+}
+
+
+/*
+Given a free_list_t pointer and the index of the bin it belongs to,
+pushes free_list to the front of the linked list a->bin[bin_index] and
+marks the bin as non-empty in the bitmap of arena a. A large block goes
+into the tree of a instead. Requires the size of free_list to be set.
+*/
+__attribute__((always_inline))
+static void insert_node(arena_t *a, free_list_t *free_list, int bin_index) {
+#if SCAVENGE_DECAY_MS
+  stamp_free(free_list, get_size(free_list));
+#endif
+#if TREE_MIN_SIZE
+  if (in_tree(free_list)) {
+    tree_insert(a, (tree_node_t *) free_list);
+    return;
+  }
+#endif
+  free_list_t *head = a->bin[bin_index];
+  if (head != NULL) {
+    head->prev = free_list;
+  }
+  free_list->prev = NULL;
+  free_list->next = head;
+  a->bin[bin_index] = free_list;
+  bin_map_set(a, bin_index);
+}
+
+
+/*
+Returns the index of the first non-empty bin of arena a strictly after
+bin_index, or -1 if every such bin is empty.
+*/
+__attribute__((always_inline))
+static int next_nonempty_bin(arena_t *a, int bin_index) {
+#if TLSF
+  int fl = bin_index >> TLSF_SL_LOG2;
+  uint32_t sl_candidates = a->sl_map[fl] & (~0u << ((bin_index & (SL_COUNT - 1)) + 1));
+  if (sl_candidates == 0) {
+    uint32_t fl_candidates = a->fl_map & (~0u << (fl + 1));
+    if (fl_candidates == 0) {
+      return -1;
+    }
+    fl = __builtin_ctz(fl_candidates);
+    sl_candidates = a->sl_map[fl];
   }
+  return (fl << TLSF_SL_LOG2) | __builtin_ctz(sl_candidates);
+#else
+  uint32_t candidates = a->bin_map & (~0u << (bin_index + 1));
+  if (candidates == 0) {
+    return -1;
+  }
+  return __builtin_ctz(candidates);
+#endif
 }
 
 
@@ -275,19 +1206,22 @@ static void delete_node(free_list_t *free_list, int bin_index) {
 Given a ptr to a block of memory, this function coalesces the block with either
 or both of the back and next memory blocks if they are free. It is required 
 the block at ptr is not in the bin. This function removes the previous or next blocks or both if 
-they get coalesced with ptr.
+they get coalesced with ptr. The neighbours of a block of arena a always belong to a too.
 */
 __attribute__((always_inline))
-static void *coalesce(void *ptr) {
+static void *coalesce(arena_t *a, void *ptr) {
   int size = get_size(ptr);
   //check the next block
-  if (my_heap_hi() > (ptr + size + SIZE_T_SIZE) && is_free_forward(ptr)) {
+  if (has_next(a, ptr, size) && is_free_forward(ptr)) {
       int next_offset = size + SIZE_T_SIZE;
       free_list_t *next_list = (free_list_t *) ((uint64_t) ptr + next_offset);
       int next_size = get_size((void *)next_list);
       size = next_offset + next_size;
-      delete_node(next_list, get_bin(next_size + SIZE_T_SIZE));
+      delete_node(a, next_list, get_bin(next_size + SIZE_T_SIZE));
       set_size(ptr, size);
+#if STATS
+      ++a->coalesces[stats_class(size)];
+#endif
   }
 
   //check the back block
@@ -295,8 +1229,11 @@ static void *coalesce(void *ptr) {
     int prev_size = get_prev_size(ptr) + SIZE_T_SIZE;
     size += prev_size;
     ptr = (char *) ptr - prev_size;
-    delete_node((free_list_t *) ptr, get_bin(prev_size));
+    delete_node(a, (free_list_t *) ptr, get_bin(prev_size));
     set_size(ptr, size);
+#if STATS
+    ++a->coalesces[stats_class(size)];
+#endif
   }
 
   //mark the coalesced block free
@@ -308,9 +1245,10 @@ static void *coalesce(void *ptr) {
 /*
 Given the required size of a new memory block, a free_list_t and the size of 
 the free_list_t plus SIZE_T_SIZE, this function splits the free_list_t into two blocks of size 
-aligned_size and free_list_size - aligned_size. It enters in the bin the latter block.
+aligned_size and free_list_size - aligned_size. It enters in the bin of arena a the latter block.
 
 Args:
+  a: the arena that owns free_list
   aligned_size: an integer size, required >= SMALLEST_SIZE_BLOCK
   free_list: a pointer to a free_list_t object. Required >= aligned_size + SMALLEST_SIZE_BLOCK.
              It is required that free_list is not in the bin
@@ -322,11 +1260,10 @@ Effect:
   and enters it into the bin. It sets the right size for the first block. 
 */
 __attribute__((always_inline))
-static void split_free_list(int aligned_size, free_list_t *free_list, int free_list_size) {
+static void split_free_list(arena_t *a, int aligned_size, free_list_t *free_list, int free_list_size) {
   int free_list_remain = free_list_size - aligned_size;
   int remain_bin_index = get_bin(free_list_remain);
   free_list_t *remain_list = (free_list_t *)((char *)free_list + aligned_size);
-  free_list_t *bin_head = bin[remain_bin_index];
 
   int remain_list_size = free_list_remain - SIZE_T_SIZE;
   set_size(remain_list, remain_list_size);
@@ -336,235 +1273,3043 @@ static void split_free_list(int aligned_size, free_list_t *free_list, int free_l
   set_size(free_list, block_size);
   mark_free(free_list, block_size);
 
-  if (bin_head != NULL){
-    bin_head->prev = remain_list;
+  insert_node(a, remain_list, remain_bin_index);
+#if STATS
+  ++a->splits[stats_class(free_list_size - SIZE_T_SIZE)];
+#endif
+}
+
+
+// frees the boundary-tag block pointed to by ptr and adds it to the free list bin of its arena a
+static void free_block(arena_t *a, void *ptr) {
+  ptr = coalesce(a, ptr);
+  size_t size = get_size(ptr);
+  if (__builtin_expect(is_huge_size(size), 0)) {
+    set_huge(ptr, size);
+    huge_push(a, (free_list_t *) ((char *) ptr + SIZE_T_SIZE));
+    return;
   }
-  remain_list->prev = NULL;
-  remain_list->next = bin_head;
-  bin[remain_bin_index] = remain_list;
+  int bin_index = get_bin(size + SIZE_T_SIZE);
+
+  insert_node(a, (free_list_t *) ptr, bin_index);
 }
 
-//----------End of free list manipulation functions 
+//----------End of free list manipulation functions
 
 
-// init - Initialize the malloc package.  Called once before any other
-// calls are made.  Since this is a very simple implementation, we just
-// return success.
-int my_init(void) { 
-  int hi = (uint64_t) my_heap_hi() + 1;
-  int req_size = align(hi) - hi;
-  mem_sbrk(req_size);
-  header_t *first_header = mem_sbrk(SIZE_T_SIZE);
-  first_header->prev_size = 0; //indicate not free
-  first_header->size = 0;
-  //intialize the bins
-  for (int i = 0; i < BIN_SIZE; i++) {
-    bin[i] = NULL;
+//----------Quick lists
+
+#if QUICK_MAX_SIZE
+
+//Defers the free of the block ptr of size size to the quick list of arena a.
+//The block stays marked allocated, so its neighbours do not coalesce with it.
+__attribute__((always_inline))
+static void quick_push(arena_t *a, void *ptr, int size) {
+  free_list_t *block = (free_list_t *) ptr;
+  block->next = a->quick[size / ALIGNMENT];
+  a->quick[size / ALIGNMENT] = block;
+  ++a->quick_count;
+}
+
+//Takes a block of size size off the quick list of arena a, or returns NULL if there is none
+__attribute__((always_inline))
+static void *quick_pop(arena_t *a, int size) {
+  free_list_t *block = a->quick[size / ALIGNMENT];
+  if (block != NULL) {
+    a->quick[size / ALIGNMENT] = block->next;
+    --a->quick_count;
   }
+  return block;
+}
 
-  return 0;
+static int compare_addresses(const void *x, const void *y) {
+  uint64_t p = (uint64_t) *(void * const *) x;
+  uint64_t q = (uint64_t) *(void * const *) y;
+  return (p > q) - (p < q);
 }
 
 /*
-walks the bin to find and return a memory of size at least size.
-Returns NULL if no such memory block exists in the bin.
+Frees every deferred block of arena a in address order, so that runs of
+adjacent deferred blocks merge into one free block.
 */
-__attribute__((always_inline))
-static void *malloc_from_free_list(size_t size) {
-  uint32_t aligned_size = align(size) + SIZE_T_SIZE;
-  int bin_index = get_bin(aligned_size);
-  free_list_t *free_list = bin[bin_index];
-
-  //tries to find a match in the bin of the best size. 
-  while (free_list != NULL) {
-    int free_list_size = get_size(free_list) + SIZE_T_SIZE;
-    if (free_list_size >= aligned_size) {
-      delete_node(free_list, bin_index);
-      if (free_list_size - aligned_size >= SMALLEST_BLOCK_SIZE) {
-        split_free_list(aligned_size, free_list, free_list_size);
-      } else {
-        size = free_list_size - SIZE_T_SIZE ;
-      }
-      mark_not_free(free_list, size);
-      set_size(free_list, size);
-      return (void *) free_list;
+static void consolidate(arena_t *a) {
+  void *blocks[QUICK_LIMIT + 1];
+  int n = 0;
+  for (int i = 0; i < QUICK_CLASSES; ++i) {
+    for (free_list_t *block = a->quick[i]; block != NULL; block = block->next) {
+      blocks[n++] = block;
     }
-    free_list = free_list->next;
+    a->quick[i] = NULL;
   }
-  
+  a->quick_count = 0;
 
-  for (int i = bin_index + 1; i < BIN_SIZE; ++i) {
-    free_list_t *free_list = bin[i];
-    if (free_list != NULL) {
-      delete_node(free_list, i);
-      int free_list_size = get_size((void *) free_list) + SIZE_T_SIZE;
-      if (free_list_size - aligned_size >= SMALLEST_BLOCK_SIZE) {
-        split_free_list(aligned_size, free_list, free_list_size);
-      } else {
-        size = free_list_size - SIZE_T_SIZE;
-      }
-      mark_not_free(free_list, size);
-      set_size(free_list, size);
-      return (void *) free_list;  
-    }
+  qsort(blocks, n, sizeof(void *), compare_addresses);
+  for (int i = 0; i < n; ++i) {
+    free_block(a, blocks[i]);
   }
-
-  //if it didn't find any freelist
-  return NULL;
 }
 
+#endif
 
-//  malloc - Allocate a block by incrementing the brk pointer.
-//  Always allocate a block whose size is a multiple of the alignment.
-void *my_malloc(size_t size) {
+//----------End of quick lists 
 
-  // We allocate a little bit of extra memory so that we can store the
-  // size of the block we've allocated and whether it is free. Take a look 
-  // at realloc to see one example of a place where this can come in handy.
-  size = align(size);
-  uint32_t aligned_size = size + SIZE_T_SIZE;
-  
-  if (aligned_size < SMALLEST_BLOCK_SIZE) {
-    size = SMALLEST_BLOCK_SIZE - SIZE_T_SIZE;
-    aligned_size = SMALLEST_BLOCK_SIZE;
-  }
+//----------Top of the heap
 
-  //first try to allocate from the linked list bin
-  void *p = malloc_from_free_list(size);
+#if ARENAS > 1
+//Records in the page map that the chunks with memory in [start, end) belong
+//to arena a, which grew the heap to end. A chunk that starts before start
+//already belongs to a, and is left alone because other threads may be
+//reading its entries.
+static void map_chunks(arena_t *a, char *start, char *end) {
+  char *first = (char *) (((uint64_t) start + ARENA_CHUNK_SIZE - 1) & ~((uint64_t) ARENA_CHUNK_SIZE - 1));
+  char *last = (char *) (((uint64_t) end + ARENA_CHUNK_SIZE - 1) & ~((uint64_t) ARENA_CHUNK_SIZE - 1));
+  page_map_grow(last);
+  for (char *p = first; p < last; p += SLAB_RUN_SIZE) {
+    get_page(p)->arena = a - arenas;
+  }
+}
+#endif
 
-  if (p != NULL) {
-    return p;
+//size of a free block at the top of the heap that free trims. It only
+//ever grows, see heap_sbrk, and like heap_trimmed it outlives my_init:
+//a program that frees its heap and builds it up again should not trim it
+//every time. Free reads it without top_lock.
+size_t trim_threshold = TRIM_THRESHOLD;
+
+//whether the heap was trimmed since it last grew
+uint8_t heap_trimmed;
+
+/*
+Grows the memory handed out to arenas by size bytes, for arena a. Once the
+reserve runs out, the heap grows by TOP_PAD_PERCENT of its size, at most by
+as much as it grew the last time and at least by what is missing. The
+padding then only gets large while the heap keeps growing, and what it
+leaves unused at the end is bounded by the last step of growth.
+
+Returns the old heap_top, or (void *)-1 if the heap cannot grow.
+*/
+static void *heap_sbrk(arena_t *a, size_t size) {
+  char *p = heap_top;
+  char *brk = (char *) mem_heap_hi() + 1;
+  if ((size_t) (brk - p) < size) {
+    size_t need = p + size - brk;
+    size_t grow = mem_heapsize() / 100 * TOP_PAD_PERCENT;
+    if (grow > heap_growth) {
+      grow = heap_growth;
+    }
+    if (grow < need) {
+      grow = need;
+    }
+    grow = (grow + TOP_PAGE_SIZE - 1) & ~((size_t) TOP_PAGE_SIZE - 1);
+
+    char *fresh_lo = mem_fresh_lo();
+    if (mem_sbrk(grow) == (void *)-1) {
+      //near the end of the heap, grow by just what is missing
+      if (grow == need || mem_sbrk(need) == (void *)-1) {
+        return (void *)-1;
+      }
+      grow = need;
+    }
+    //the reserve stays fresh from heap_fresh_lo on only if the new memory
+    //follows it without a gap of memory that was used before
+    if (p == brk || fresh_lo != brk) {
+      heap_fresh_lo = fresh_lo;
+    }
+    heap_growth = grow;
+#if TRIM_THRESHOLD
+    //the heap grows back after a trim, so trimming it cost page faults for
+    //nothing: trim only at twice the size from now on
+    if (heap_trimmed) {
+      heap_trimmed = 0;
+      __atomic_store_n(&trim_threshold, trim_threshold * 2, __ATOMIC_RELAXED);
+    }
+#endif
+#if STATS
+    ++a->sbrk_calls;
+    a->sbrk_bytes += grow;
+#endif
   }
+  (void) a;
+  heap_top = p + size;
+  return p;
+}
 
-  //check if the last block in the heap is empty and increase it by the needed size
-  if (is_free_back(my_heap_hi() + 1)) {
-    int prev_size = get_prev_size(my_heap_hi() + 1);
-    int req_size = size - prev_size;
-    p = my_heap_hi() - prev_size - SIZE_T_SIZE  + 1;
-    delete_node((free_list_t *) p, get_bin(prev_size + SIZE_T_SIZE));
-    mem_sbrk(req_size);
-    set_size(p, size);
-    mark_not_free(p, size);
-    return p;
+//Records that the bytes of arena a from p to the top of the heap have
+//never been used, given fresh_lo, the first byte of the reserve that was
+//never handed out before they were. my_calloc skips clearing them.
+__attribute__((always_inline))
+static void note_fresh(arena_t *a, char *p, char *fresh_lo) {
+  if (p < fresh_lo) {
+    p = fresh_lo;
   }
+  if (p < a->fresh) {
+    a->fresh = p;
+  }
+}
 
-  p = mem_sbrk(aligned_size);
+/*
+Grows the heap by size bytes for arena a, which must own the top of the heap.
 
+Returns the old top of the heap, or (void *)-1 if the heap cannot grow.
+*/
+static void *arena_sbrk(arena_t *a, size_t size) {
+  char *p = heap_sbrk(a, size);
   if (p == (void *)-1) {
-    // Whoops, an error of some sort occurred.  We return NULL to let
-    // the client code know that we weren't able to allocate memory.
-    return NULL;
+    return p;
+  }
+  note_fresh(a, p, heap_fresh_lo);
+  a->top = p + size;
+#if ARENAS > 1
+  map_chunks(a, p, a->top);
+#elif PAGE_MAP
+  page_map_grow(a->top);
+#endif
+  return p;
+}
+
+#if ARENAS > 1
+/*
+Hands the top of the heap over to arena a. The last run of the previous
+owner is sealed by turning its pending block into an allocated block of
+size 0. The new run of a starts on the next ARENA_CHUNK_SIZE boundary
+with a single free block of ARENA_CHUNK_SIZE bytes, and the gap before
+it is filled with an allocated block that is never freed.
+
+Returns 0, or -1 if the heap cannot grow.
+*/
+static int take_top(arena_t *a) {
+  char *top = heap_top;
+  char *start = (char *) (((uint64_t) top + SIZE_T_SIZE + ARENA_CHUNK_SIZE - 1) & ~((uint64_t) ARENA_CHUNK_SIZE - 1));
+  //the new run is not fresh for my_calloc: its free block holds links and
+  //the header of the pending block lies at its end
+  if (heap_sbrk(a, start + ARENA_CHUNK_SIZE - top) == (void *)-1) {
+    return -1;
+  }
+
+  set_size(top, 0);
+  header_t *first_header = (header_t *) (start - SIZE_T_SIZE);
+  if ((char *) first_header == top) {
+    first_header->prev_size = 0;
   } else {
-    // We store the size of the block we've allocated in the first
-    // SIZE_T_SIZE bytes and we mark the block not free
-    set_size(p, size);
-    mark_not_free(p, size);
+    char *filler = top + SIZE_T_SIZE;
+    int filler_size = (char *) first_header - filler;
+    ((header_t *) top)->prev_size = 0;
+    set_size(filler, filler_size);
+    mark_not_free(filler, filler_size);
+  }
 
-    // Then, we return a pointer to the rest of the block of memory,
-    // which is at least size bytes long.  We have to cast to uint8_t
-    // before we try any pointer arithmetic because voids have no size
-    // and so the compiler doesn't know how far to move the pointer.
-    // Since a uint8_t is always one byte, adding SIZE_T_SIZE after
-    // casting advances the pointer by SIZE_T_SIZE bytes.
-    return (void *) p;
+  a->top = start + ARENA_CHUNK_SIZE;
+  map_chunks(a, start, a->top);
+  set_size(start, ARENA_CHUNK_SIZE - SIZE_T_SIZE);
+  mark_free(start, ARENA_CHUNK_SIZE - SIZE_T_SIZE);
+  insert_node(a, (free_list_t *) start, get_bin(ARENA_CHUNK_SIZE));
+  return 0;
+}
+#endif
+
+/*
+Takes top_lock for an operation of arena a at the top of the heap, and
+makes a the owner of the top if another arena grew the heap last.
+
+Returns 0 if a already owned the top, 1 if it just took it over and has a
+new free block in its bins, or -1 if the heap cannot grow. top_lock is
+held in every case.
+*/
+static int lock_top(arena_t *a) {
+  lock_top_of_heap();
+#if ARENAS > 1
+  if (a->top != heap_top) {
+    return take_top(a) == 0 ? 1 : -1;
   }
+#else
+  (void) a;
+#endif
+  return 0;
 }
 
+//----------End of top of the heap
 
-// frees the block pointed to by ptr and adds it to the free list bin
-void my_free(void *ptr) {
-  ptr = coalesce(ptr);
-  int size = get_size(ptr) + SIZE_T_SIZE;
-  int bin_index = get_bin(size);
 
-  free_list_t *node = ptr;
-  node->next = NULL;
-  node->prev = NULL;
+//----------Huge allocations
 
-  free_list_t *head = bin[bin_index];
-  if (head == NULL) {
-    bin[bin_index] = node;
+//Frees the block at ptr of size size, which was split off another block of
+//arena a, as a huge block if it is large enough
+static void free_rest(arena_t *a, char *ptr, size_t size) {
+  if (is_huge_size(size)) {
+    set_huge(ptr, size);
+    huge_push(a, (free_list_t *) (ptr + SIZE_T_SIZE));
   } else {
-    head->prev = node;
-    node->next = head;
-    bin[bin_index] = node;
+    set_size(ptr, size);
+    free_block(a, ptr);
   }
 }
 
-// realloc - reallocates a space of size size, and copies the minimum of get_size(ptr) and size amounts 
-//of memory from ptr to the new space
-void *my_realloc(void *ptr, size_t size) {
-  void *newptr;
-  uint32_t copy_size;
-  size = align(size);
-  int aligned_size = size + SIZE_T_SIZE;
+/*
+Allocates a huge block of arena a for a request of size bytes.
 
-  int curr_size = get_size(ptr);
-  int curr_aligned_size = curr_size + SIZE_T_SIZE;
+Returns the pointer handed out for the block, or NULL if the heap cannot grow.
+*/
+static void *huge_malloc(arena_t *a, size_t size) {
+  size_t block_size = huge_block_size(size);
 
-  if (size == 0 || ptr == NULL) {
-     if (ptr != NULL)
-        my_free(ptr);
-     return NULL;
+  free_list_t *best = NULL;
+  size_t best_size = SIZE_MAX;
+  for (free_list_t *free_list = a->huge; free_list != NULL; free_list = free_list->next) {
+    size_t free_size = get_size((char *) free_list - SIZE_T_SIZE);
+    if (free_size >= block_size && free_size < best_size) {
+      best = free_list;
+      best_size = free_size;
+    }
   }
 
+  if (best != NULL) {
+    huge_remove(a, best);
+    char *block = (char *) best - SIZE_T_SIZE;
+    if (best_size - block_size >= SMALLEST_BLOCK_SIZE) {
+      set_huge(block, block_size);
+      free_rest(a, block + block_size + SIZE_T_SIZE, best_size - block_size - SIZE_T_SIZE);
+    }
+    return best;
+  }
 
-  if (curr_size >= size) {
-    int remain_size = curr_size - size;
+  if (lock_top(a) < 0) {
+    unlock_top_of_heap();
+    return NULL;
+  }
+  char *block = arena_sbrk(a, block_size + SIZE_T_SIZE);
+  unlock_top_of_heap();
+  if (block == (void *)-1) {
+    return NULL;
+  }
+  set_huge(block, block_size);
+  return block + SIZE_T_SIZE;
+}
+
+/*
+Carves a boundary-tag block of size size off the front of a free huge
+block of arena a.
+
+Returns the block, or NULL if no free huge block is large enough.
+*/
+static void *huge_carve(arena_t *a, int size) {
+  for (free_list_t *free_list = a->huge; free_list != NULL; free_list = free_list->next) {
+    char *block = (char *) free_list - SIZE_T_SIZE;
+    size_t block_size = get_size(block);
+    if (block_size >= (size_t) size + SMALLEST_BLOCK_SIZE) {
+      huge_remove(a, free_list);
+      set_size(block, size);
+      mark_not_free(block, size);
+      free_rest(a, block + size + SIZE_T_SIZE, block_size - size - SIZE_T_SIZE);
+      return block;
+    }
+  }
+  return NULL;
+}
+
+//frees the huge block handed out as ptr, which belongs to arena a
+static void huge_free(arena_t *a, void *ptr) {
+  huge_push(a, (free_list_t *) ptr);
+}
+
+/*
+Cuts size bytes at a multiple of alignment out of the allocated block of
+arena a handed out as p, which must have room for them past a leading
+fragment of at least SMALLEST_BLOCK_SIZE bytes. The fragment and a large
+enough tail are freed.
+
+Returns the aligned pointer.
+*/
+static void *align_block(arena_t *a, char *p, size_t alignment, size_t size) {
+  char *block = is_huge(p) ? p - SIZE_T_SIZE : p;
+  char *end = block + get_size(block);
+  char *q = (char *) (((uint64_t) p + alignment - 1) & ~((uint64_t) alignment - 1));
+  if (q != p && q - p < SMALLEST_BLOCK_SIZE) {
+    q += alignment;
+  }
+
+  //the aligned block stays huge only if it is too large for a boundary-tag
+  //block, so that free huge blocks are never smaller than HUGE_MIN_SIZE. A
+  //block that is aligned already keeps its kind: a boundary-tag block may
+  //be a few bytes larger than that limit.
+  int huge = q == p ? is_huge(p) : is_huge_size(end - q);
+  char *aligned = huge ? q - SIZE_T_SIZE : q;
+  if (aligned != block) {
+    if (huge) {
+      set_huge(aligned, end - aligned);
+    } else {
+      set_size(aligned, end - aligned);
+      mark_not_free(aligned, end - aligned);
+    }
+    free_rest(a, block, aligned - block - SIZE_T_SIZE);
+  }
+
+  if (!huge) {
+    int aligned_size = max(align(size), SMALLEST_BLOCK_SIZE - SIZE_T_SIZE);
+    size_t remain_size = end - aligned - aligned_size;
     if (remain_size >= SMALLEST_BLOCK_SIZE) {
-      split_free_list(aligned_size, (free_list_t *) ptr, curr_size + SIZE_T_SIZE);
-      // ptr = coalesce(ptr);
-      // mark_not_free(ptr, size);
-      // set_size(ptr, size);
+      set_size(aligned, aligned_size);
+      mark_not_free(aligned, aligned_size);
+      free_rest(a, aligned + aligned_size + SIZE_T_SIZE, remain_size - SIZE_T_SIZE);
     }
-    return ptr;
   }
+  return q;
+}
 
+//----------End of huge allocations
 
-  // Get the size of the old block of memory.  Take a peek at my_malloc(),
-  // where we stashed this in the SIZE_T_SIZE bytes directly before the
-  // address we returned.  Now we can back up by that many bytes and read
-  // the size.
-  copy_size = get_size(ptr);
 
+//----------Trimming the heap
 
-  if (my_heap_hi() > (ptr + curr_size + SIZE_T_SIZE) && is_free_forward(ptr)) {
-    int next_total_size = get_size((void *) ((uint64_t) ptr + curr_aligned_size)) + SIZE_T_SIZE;
-    int remain_size = next_total_size + curr_size - size;
-    if (remain_size >= 0) {
-      delete_node((free_list_t *) ((uint64_t) ptr + curr_aligned_size), get_bin(next_total_size));
-      if (remain_size >= SMALLEST_BLOCK_SIZE) {
-        split_free_list(aligned_size, (free_list_t *) ptr, curr_aligned_size + next_total_size);
-      } else {
-          size = curr_size + next_total_size;
+/*
+Gives the free blocks at the top of the heap back to memlib, except for
+their first pad bytes, if arena a owns the top. The reserve goes back too,
+and the heap grows without padding again the next time. Requires the lock
+of a; takes top_lock.
+
+Returns the number of bytes the heap shrank by.
+*/
+static size_t trim_top(arena_t *a, size_t pad) {
+  lock_top_of_heap();
+  if (a->top != heap_top) {
+    unlock_top_of_heap();
+    return 0;
+  }
+
+  //take the free blocks off the top, a boundary-tag block or a huge block
+  //at a time
+  char *top = a->top;
+  for (;;) {
+    uint32_t prev_size = ((header_t *) (top - SIZE_T_SIZE))->prev_size;
+    if (prev_size & 1) {
+      char *block = top - (prev_size & ~1u) - SIZE_T_SIZE;
+      delete_node(a, (free_list_t *) block, get_bin(top - block));
+      top = block;
+      continue;
+    }
+    free_list_t *huge = NULL;
+    if (prev_size & PREV_HUGE) {
+      for (huge = a->huge; huge != NULL; huge = huge->next) {
+        if ((char *) huge + get_size((char *) huge - SIZE_T_SIZE) == top) {
+          break;
+        }
       }
-      mark_not_free(ptr, size);
-      set_size(ptr, size);
-      return ptr;
     }
+    if (huge == NULL) {
+      break;
+    }
+    huge_remove(a, huge);
+    top = (char *) huge - SIZE_T_SIZE;
   }
 
-  
-  if (ptr + curr_size + SIZE_T_SIZE - 1 == my_heap_hi()) {
-     mem_sbrk(size - curr_size);
-     set_size(ptr, size);
-     mark_not_free(ptr, size);
-     return ptr;
+  //the pad bytes stay as one free block
+  size_t free_size = a->top - top;
+  size_t keep = 0;
+  if (pad != 0 && free_size != 0) {
+    keep = (pad + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+    if (keep < SMALLEST_BLOCK_SIZE) {
+      keep = SMALLEST_BLOCK_SIZE;
+    }
+    if (keep + SMALLEST_BLOCK_SIZE > free_size) {
+      keep = free_size;
+    }
+  }
+  a->top = top + keep;
+  if (keep != 0) {
+    free_rest(a, top, keep - SIZE_T_SIZE);
+  } else {
+    set_size(top, 0);
   }
 
-  // Allocate a new chunk of memory, and fail if that allocation fails.
-  newptr = my_malloc(size);
-  if (NULL == newptr) {
+  char *brk = (char *) mem_heap_hi() + 1;
+  size_t trimmed = brk - a->top;
+  heap_top = a->top;
+  heap_growth = 0;
+  heap_trimmed |= trimmed != 0;
+  mem_trim(trimmed);
+  heap_fresh_lo = mem_fresh_lo();
+  unlock_top_of_heap();
+  return trimmed;
+}
+
+#if MEM_MMAP
+/*
+Gives the whole pages inside the free block at ptr, whose links start at
+node, back to memlib. The size word of a huge block, the links and the
+epoch word of the scavenger stay. With the scavenger, a block that it looks
+at is only released if it was freed before epoch before, and only once; the
+blocks it skips are only released for before == UINT64_MAX.
+
+Returns the number of bytes released.
+*/
+static size_t release_block(char *ptr, void *node, uint64_t before) {
+  size_t size = get_size(ptr);
+#if SCAVENGE_DECAY_MS
+  if (size >= SCAVENGE_MIN_SIZE) {
+    uint64_t *epoch = free_epoch(node);
+    if (*epoch >= before) {
+      return 0;
+    }
+    *epoch = UINT64_MAX;
+  } else if (before != UINT64_MAX) {
+    return 0;
+  }
+#else
+  (void) node;
+  (void) before;
+#endif
+  size_t kept = 2 * SIZE_T_SIZE + sizeof(tree_node_t);
+  return size > kept ? mem_release(ptr + kept, size - kept) : 0;
+}
+
+//Gives the whole pages inside the free blocks of arena a back to memlib, for
+//the blocks freed before epoch before, see release_block. Returns the number
+//of bytes released.
+static size_t release_free_blocks(arena_t *a, uint64_t before) {
+  size_t released = 0;
+  int first_bin = 0;
+#if SCAVENGE_DECAY_MS
+  if (before != UINT64_MAX) {
+    first_bin = get_bin(SCAVENGE_MIN_SIZE);
+  }
+#endif
+  for (int i = first_bin; i < BIN_SIZE; ++i) {
+    for (free_list_t *block = a->bin[i]; block != NULL; block = block->next) {
+      released += release_block((char *) block, block, before);
+    }
+  }
+#if TREE_MIN_SIZE
+  //walks the tree in order with the parent links
+  tree_node_t *node = a->tree;
+  while (node != NULL && node->left != NULL) {
+    node = node->left;
+  }
+  while (node != NULL) {
+    released += release_block((char *) node, node, before);
+    if (node->right != NULL) {
+      node = node->right;
+      while (node->left != NULL) {
+        node = node->left;
+      }
+    } else {
+      while (node->parent != NULL && node->parent->right == node) {
+        node = node->parent;
+      }
+      node = node->parent;
+    }
+  }
+#endif
+  for (free_list_t *block = a->huge; block != NULL; block = block->next) {
+    released += release_block((char *) block - SIZE_T_SIZE, block, before);
+  }
+  return released;
+}
+#endif
+
+//----------End of trimming the heap
+
+
+//----------Scavenger
+
+#if SCAVENGE_DECAY_MS
+
+/*
+The scavenger thread ticks scavenge_epoch every SCAVENGE_DECAY_MS
+milliseconds. Free blocks of at least SCAVENGE_MIN_SIZE bytes record the
+epoch in which they became free, and after each tick the scavenger releases
+the pages inside those that were freed two epochs ago or earlier, which have
+been free for at least SCAVENGE_DECAY_MS and at most twice that. Free only
+writes the epoch, so the page releases stay off its path. A pass holds
+scavenge_lock, which my_init takes too, and one arena lock at a time.
+*/
+pthread_mutex_t scavenge_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t scavenge_cond = PTHREAD_COND_INITIALIZER;
+pthread_t scavenge_thread;
+
+//whether the scavenger runs, protected by scavenge_lock
+uint8_t scavenge_running;
+
+static void *scavenge(void *arg) {
+  (void) arg;
+  pthread_mutex_lock(&scavenge_lock);
+  while (scavenge_running) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SCAVENGE_DECAY_MS / 1000;
+    deadline.tv_nsec += SCAVENGE_DECAY_MS % 1000 * 1000000l;
+    if (deadline.tv_nsec >= 1000000000l) {
+      ++deadline.tv_sec;
+      deadline.tv_nsec -= 1000000000l;
+    }
+    //my_scavenger_stop signals the condition to end the wait early
+    while (scavenge_running &&
+           pthread_cond_timedwait(&scavenge_cond, &scavenge_lock, &deadline) == 0) {
+    }
+    if (!scavenge_running) {
+      break;
+    }
+
+    uint64_t epoch = __atomic_add_fetch(&scavenge_epoch, 1, __ATOMIC_RELAXED);
+    for (int k = 0; k < ARENAS; ++k) {
+      arena_t *a = &arenas[k];
+      lock_arena(a);
+      release_free_blocks(a, epoch - 1);
+      unlock_arena(a);
+    }
+  }
+  pthread_mutex_unlock(&scavenge_lock);
+  return NULL;
+}
+
+#endif
+
+//----------End of scavenger
+
+
+//----------Slab runs for tiny size classes
+
+#if SLAB_MAX_SIZE
+
+#define SLAB_MAP_WORDS ((SLAB_RUN_SIZE / ALIGNMENT + 63) / 64)
+
+/*
+A slab run is an allocated block of the boundary-tag heap whose payload is
+SLAB_RUN_SIZE bytes aligned to SLAB_RUN_SIZE. It starts with this
+descriptor and the rest holds objects of a single size class, which
+carry no header: the class of an object is found from the run that
+contains it.
+*/
+struct slab_run_t {
+  struct slab_run_t *prev;
+  struct slab_run_t *next;
+  uint32_t obj_size;
+  uint32_t nfree;
+  uint32_t nslots;
+  uint32_t unused;
+  uint64_t free_slots[SLAB_MAP_WORDS]; //bit i is set iff slot i is free
+};
+typedef struct slab_run_t slab_run_t;
+
+#define SLAB_HEADER_SIZE ((int) sizeof(slab_run_t))
+
+//Gets the class of the slab object ptr plus one, or 0 if ptr is a
+//boundary-tag block
+__attribute__((always_inline))
+static int slab_class(void *ptr) {
+  //a thread cache may look up an object while its arena turns another page
+  //into a run, so the class is accessed atomically
+  return __atomic_load_n(&get_page(ptr)->slab_class, __ATOMIC_RELAXED);
+}
+
+//Gets the run that contains the slab object ptr
+__attribute__((always_inline))
+static slab_run_t *get_run(void *ptr) {
+  return (slab_run_t *) ((uint64_t) ptr & ~((uint64_t) SLAB_RUN_SIZE - 1));
+}
+
+//Removes run from the list of partial runs of class class_index of arena a
+static void unlink_run(arena_t *a, slab_run_t *run, int class_index) {
+  if (run->next != NULL) {
+    run->next->prev = run->prev;
+  }
+  if (run->prev != NULL) {
+    run->prev->next = run->next;
+  } else {
+    a->slab_partial[class_index] = run->next;
+  }
+}
+
+//Pushes run to the front of the list of partial runs of class class_index of arena a
+static void link_run(arena_t *a, slab_run_t *run, int class_index) {
+  run->prev = NULL;
+  run->next = a->slab_partial[class_index];
+  if (run->next != NULL) {
+    run->next->prev = run;
+  }
+  a->slab_partial[class_index] = run;
+}
+
+/*
+Carves a block of size size whose payload is aligned to SLAB_RUN_SIZE off
+the top of the heap for arena a. A free block at the top of the heap is
+reused, and the gap in front of the aligned payload is left in the bins
+as a free block. The heap only grows if grow_heap is set.
+
+Returns NULL if the heap cannot or may not grow.
+*/
+static void *sbrk_aligned(arena_t *a, int size, int grow_heap) {
+  if (lock_top(a) < 0) {
+    unlock_top_of_heap();
+    return NULL;
+  }
+  char *top = a->top;
+  char *start = top;
+  if (is_free_back(top)) {
+    start = top - get_prev_size(top) - SIZE_T_SIZE;
+  }
+
+  int pad = (-(uint64_t) start) & (SLAB_RUN_SIZE - 1);
+  if (pad != 0 && pad < SMALLEST_BLOCK_SIZE) {
+    pad += SLAB_RUN_SIZE;
+  }
+  char *p = start + pad;
+
+  int64_t grow = (int64_t) (p + size + SIZE_T_SIZE - top);
+  if (grow > 0 && !grow_heap) {
+    unlock_top_of_heap();
+    return NULL;
+  }
+  if (start != top) {
+    delete_node(a, (free_list_t *) start, get_bin(top - start));
+  }
+  if (grow > 0 && arena_sbrk(a, grow) == (void *)-1) {
+    if (start != top) {
+      mark_free(start, top - start - SIZE_T_SIZE);
+      insert_node(a, (free_list_t *) start, get_bin(top - start));
+    }
+    unlock_top_of_heap();
     return NULL;
   }
+  if (grow < 0) {
+    //the old top block reaches past the new block, keep the tail only if
+    //it can stand on its own
+    if (-grow >= SMALLEST_BLOCK_SIZE) {
+      char *tail = p + size + SIZE_T_SIZE;
+      set_size(tail, -grow - SIZE_T_SIZE);
+      mark_free(tail, -grow - SIZE_T_SIZE);
+      insert_node(a, (free_list_t *) tail, get_bin(-grow));
+    } else {
+      size -= grow;
+    }
+  }
 
-  // This is a standard library call that performs a simple memory copy.
-  memcpy(newptr, ptr, copy_size);
+  if (pad != 0) {
+    set_size(start, pad - SIZE_T_SIZE);
+    mark_free(start, pad - SIZE_T_SIZE);
+    insert_node(a, (free_list_t *) start, get_bin(pad));
+  }
 
-  // Release the old block.
-  my_free(ptr);
+  set_size(p, size);
+  mark_not_free(p, size);
+  unlock_top_of_heap();
+  return p;
+}
 
-  // Return a pointer to the new block.
-  return newptr;
+/*
+Creates a new empty run for class class_index and makes it a partial run of
+arena a. The run is taken from the top of the heap if that needs no growth,
+or else from a free block of the bins before the heap grows. Otherwise the
+runs that slab_free keeps would leave the memory below them behind as new
+runs are carved above them.
+*/
+static slab_run_t *new_run(arena_t *a, int class_index) {
+  slab_run_t *run = sbrk_aligned(a, SLAB_RUN_SIZE, 0);
+  int padded = 2 * SLAB_RUN_SIZE + SMALLEST_BLOCK_SIZE;
+  if (run == NULL && padded + SIZE_T_SIZE < HUGE_MIN_SIZE) {
+    char *p = malloc_from_free_list(a, padded);
+    if (p != NULL) {
+      run = align_block(a, p, SLAB_RUN_SIZE, SLAB_RUN_SIZE);
+    }
+  }
+  if (run == NULL) {
+    run = sbrk_aligned(a, SLAB_RUN_SIZE, 1);
+  }
+  if (run == NULL) {
+    return NULL;
+  }
+
+  uint32_t obj_size = (class_index + 1) * ALIGNMENT;
+  uint32_t nslots = (SLAB_RUN_SIZE - SLAB_HEADER_SIZE) / obj_size;
+  run->obj_size = obj_size;
+  run->nfree = nslots;
+  run->nslots = nslots;
+  for (int i = 0; i < SLAB_MAP_WORDS; ++i) {
+    int first = i * 64;
+    if (first + 64 <= nslots) {
+      run->free_slots[i] = ~0ull;
+    } else if (first < nslots) {
+      run->free_slots[i] = (1ull << (nslots - first)) - 1;
+    } else {
+      run->free_slots[i] = 0;
+    }
+  }
+
+  __atomic_store_n(&get_page(run)->slab_class, class_index + 1, __ATOMIC_RELAXED);
+  link_run(a, run, class_index);
+  return run;
+}
+
+//Allocates an object of at most SLAB_MAX_SIZE bytes from a slab run of arena a
+static void *slab_malloc(arena_t *a, size_t size) {
+  int class_index = size == 0 ? 0 : (size - 1) / ALIGNMENT;
+  slab_run_t *run = a->slab_partial[class_index];
+  if (run == NULL) {
+    run = new_run(a, class_index);
+    if (run == NULL) {
+      return NULL;
+    }
+  }
+
+  int word = 0;
+  while (run->free_slots[word] == 0) {
+    ++word;
+  }
+  int bit = __builtin_ctzll(run->free_slots[word]);
+  run->free_slots[word] &= ~(1ull << bit);
+  if (--run->nfree == 0) {
+    unlink_run(a, run, class_index);
+  }
+  return (char *) run + SLAB_HEADER_SIZE + (word * 64 + bit) * run->obj_size;
+}
+
+/*
+Returns the slab object ptr of class class_index to its run, which belongs to
+arena a. A run that becomes empty is given back to the boundary-tag heap
+unless it is the only partial run of its class.
+*/
+static void slab_free(arena_t *a, void *ptr, int class_index) {
+  slab_run_t *run = get_run(ptr);
+  int slot = ((char *) ptr - (char *) run - SLAB_HEADER_SIZE) / ((class_index + 1) * ALIGNMENT);
+
+  run->free_slots[slot / 64] |= 1ull << (slot % 64);
+  if (run->nfree++ == 0) {
+    link_run(a, run, class_index);
+  } else if (run->nfree == run->nslots && (run->prev != NULL || run->next != NULL)) {
+    unlink_run(a, run, class_index);
+    __atomic_store_n(&get_page(run)->slab_class, 0, __ATOMIC_RELAXED);
+    free_block(a, run);
+  }
+}
+
+/*
+returns 1 if every partial run of arena a has its class in the page map, is
+owned by a, holds objects of its class and has as many free slot bits set
+as nfree says, or 0 otherwise
+*/
+static uint8_t check_slab(arena_t *a) {
+  for (int i = 0; i < SLAB_CLASSES; ++i) {
+    for (slab_run_t *run = a->slab_partial[i]; run != NULL; run = run->next) {
+      if (slab_class(run) != i + 1 || get_arena(run) != a || run->obj_size != (i + 1) * ALIGNMENT || run->nfree == 0) {
+        return 0;
+      }
+      uint32_t nfree = 0;
+      for (int j = 0; j < SLAB_MAP_WORDS; ++j) {
+        nfree += __builtin_popcountll(run->free_slots[j]);
+      }
+      if (nfree != run->nfree) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+#endif
+
+//----------End of slab runs
+
+
+//----------Block copies
+
+/*
+Realloc copies blocks, which are 8-byte aligned and a whole number of
+words long. Small blocks are copied a word at a time inline, without the
+call into memcpy and its dispatch on size and alignment. Large blocks are
+copied with streaming stores: the moved data is rarely read again soon,
+and writing it around the cache keeps the cache for the rest of the
+program. The vector width of the streaming copy is chosen once by CPUID.
+Calloc clears blocks with the same split between inline word stores and a
+library call.
+*/
+
+// Blocks of at most this many bytes are copied a word at a time
+#define WORD_COPY_MAX_SIZE 64
+
+// Blocks of at least this many bytes are copied with streaming stores (0 disables)
+#ifndef STREAM_COPY_MIN_SIZE
+#define STREAM_COPY_MIN_SIZE (1024 * 1024)
+#endif
+
+#if STREAM_COPY_MIN_SIZE && defined(__x86_64__)
+
+//Copies size bytes from src to dst with 16-byte streaming stores. The
+//bytes before the first 16-byte boundary of dst and after the last one are
+//copied with memcpy.
+static void stream_copy_sse2(char *dst, const char *src, size_t size) {
+  size_t head = -(uint64_t) dst & 15;
+  memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+  for (; size >= 64; size -= 64, dst += 64, src += 64) {
+    __m128i x0 = _mm_loadu_si128((const __m128i *) src);
+    __m128i x1 = _mm_loadu_si128((const __m128i *) (src + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i *) (src + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i *) (src + 48));
+    _mm_stream_si128((__m128i *) dst, x0);
+    _mm_stream_si128((__m128i *) (dst + 16), x1);
+    _mm_stream_si128((__m128i *) (dst + 32), x2);
+    _mm_stream_si128((__m128i *) (dst + 48), x3);
+  }
+  _mm_sfence();
+  memcpy(dst, src, size);
+}
+
+//Same as stream_copy_sse2 with 32-byte stores, for CPUs with AVX2
+__attribute__((target("avx2")))
+static void stream_copy_avx2(char *dst, const char *src, size_t size) {
+  size_t head = -(uint64_t) dst & 31;
+  memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+  for (; size >= 128; size -= 128, dst += 128, src += 128) {
+    __m256i y0 = _mm256_loadu_si256((const __m256i *) src);
+    __m256i y1 = _mm256_loadu_si256((const __m256i *) (src + 32));
+    __m256i y2 = _mm256_loadu_si256((const __m256i *) (src + 64));
+    __m256i y3 = _mm256_loadu_si256((const __m256i *) (src + 96));
+    _mm256_stream_si256((__m256i *) dst, y0);
+    _mm256_stream_si256((__m256i *) (dst + 32), y1);
+    _mm256_stream_si256((__m256i *) (dst + 64), y2);
+    _mm256_stream_si256((__m256i *) (dst + 96), y3);
+  }
+  _mm_sfence();
+  memcpy(dst, src, size);
+}
+
+//The streaming copy for this CPU, chosen by my_init
+static void (*stream_copy)(char *dst, const char *src, size_t size) = stream_copy_sse2;
+
+//Picks the widest streaming copy the CPU supports
+static void init_stream_copy(void) {
+  __builtin_cpu_init();
+  stream_copy = __builtin_cpu_supports("avx2") ? stream_copy_avx2 : stream_copy_sse2;
+}
+
+#else
+
+static void init_stream_copy(void) {
+}
+
+#endif
+
+//Copies the size bytes of the block at src to the block at dst, which must
+//not overlap. size is a multiple of 8 and both blocks are 8-byte aligned.
+__attribute__((always_inline))
+static void copy_block(void *dst, const void *src, size_t size) {
+  if (size <= WORD_COPY_MAX_SIZE) {
+    uint64_t *d = dst;
+    const uint64_t *s = src;
+    //a loop would be turned back into a call to memcpy
+    switch (size / 8) {
+      case 8: d[7] = s[7]; /* fallthrough */
+      case 7: d[6] = s[6]; /* fallthrough */
+      case 6: d[5] = s[5]; /* fallthrough */
+      case 5: d[4] = s[4]; /* fallthrough */
+      case 4: d[3] = s[3]; /* fallthrough */
+      case 3: d[2] = s[2]; /* fallthrough */
+      case 2: d[1] = s[1]; /* fallthrough */
+      case 1: d[0] = s[0];
+    }
+    return;
+  }
+#if STREAM_COPY_MIN_SIZE && defined(__x86_64__)
+  if (size >= STREAM_COPY_MIN_SIZE) {
+    stream_copy(dst, src, size);
+    return;
+  }
+#endif
+  memcpy(dst, src, size);
+}
+
+//The copy used by realloc, for allocator_test to compare with memcpy
+void my_memcpy(void *dst, const void *src, size_t size) {
+  copy_block(dst, src, size);
+}
+
+//Zeroes the size bytes at dst, which is 8-byte aligned. size is a multiple
+//of 8. Larger blocks go to memset, which clears with the widest vector
+//stores the CPU has.
+__attribute__((always_inline))
+static void clear_block(void *dst, size_t size) {
+  if (size <= WORD_COPY_MAX_SIZE) {
+    uint64_t *d = dst;
+    switch (size / 8) {
+      case 8: d[7] = 0; /* fallthrough */
+      case 7: d[6] = 0; /* fallthrough */
+      case 6: d[5] = 0; /* fallthrough */
+      case 5: d[4] = 0; /* fallthrough */
+      case 4: d[3] = 0; /* fallthrough */
+      case 3: d[2] = 0; /* fallthrough */
+      case 2: d[1] = 0; /* fallthrough */
+      case 1: d[0] = 0;
+    }
+    return;
+  }
+  memset(dst, 0, size);
+}
+
+//----------End of block copies
+
+
+// init - Initialize the malloc package.  Called once before any other
+// calls are made.  Since this is a very simple implementation, we just
+// return success.
+#if STATS
+static void stats_reset(void);
+#endif
+#if PROFILE_SAMPLE_BYTES
+static void profile_reset(void);
+#endif
+
+int my_init(void) { 
+#if SCAVENGE_DECAY_MS
+  //no pass of the scavenger may walk the arenas while they are reset
+  pthread_mutex_lock(&scavenge_lock);
+#endif
+#if THREADS
+  //invalidates every thread cache, which hold blocks of the old heap
+  ++heap_generation;
+#endif
+#if STATS
+  stats_reset();
+#endif
+#if PROFILE_SAMPLE_BYTES
+  profile_reset();
+#endif
+  init_stream_copy();
+  int hi = (uint64_t) my_heap_hi() + 1;
+  int req_size = align(hi) - hi;
+  mem_sbrk(req_size);
+  header_t *first_header = mem_sbrk(SIZE_T_SIZE);
+  first_header->prev_size = 0; //indicate not free
+  first_header->size = 0;
+  //intialize the arenas, the first one owns the top of the heap
+  for (int i = 0; i < ARENAS; i++) {
+    arena_t *a = &arenas[i];
+    for (int j = 0; j < BIN_SIZE; j++) {
+      a->bin[j] = NULL;
+    }
+#if TREE_MIN_SIZE
+    a->tree = NULL;
+#endif
+#if TLSF
+    a->fl_map = 0;
+    for (int j = 0; j < FL_COUNT; j++) {
+      a->sl_map[j] = 0;
+    }
+#else
+    a->bin_map = 0;
+#endif
+#if SLAB_MAX_SIZE
+    for (int j = 0; j < SLAB_CLASSES; j++) {
+      a->slab_partial[j] = NULL;
+    }
+#endif
+#if QUICK_MAX_SIZE
+    for (int j = 0; j < QUICK_CLASSES; j++) {
+      a->quick[j] = NULL;
+    }
+    a->quick_count = 0;
+#endif
+    a->huge = NULL;
+    a->top = NULL;
+#if THREADS
+    a->remote_free = NULL;
+#endif
+#if STATS
+    memset(a->splits, 0, sizeof(a->splits));
+    memset(a->coalesces, 0, sizeof(a->coalesces));
+    a->sbrk_calls = 0;
+    a->sbrk_bytes = 0;
+#endif
+  }
+  heap_top = (char *) my_heap_hi() + 1;
+  heap_fresh_lo = mem_fresh_lo();
+  heap_growth = 0;
+  arenas[0].top = heap_top;
+#if STATS
+  arenas[0].sbrk_calls = 2;
+  arenas[0].sbrk_bytes = req_size + SIZE_T_SIZE;
+#endif
+#if PAGE_MAP
+  page_map_reset();
+  page_map_grow(arenas[0].top);
+#endif
+#if SCAVENGE_DECAY_MS
+  pthread_mutex_unlock(&scavenge_lock);
+#endif
+
+  return 0;
+}
+
+/*
+Takes the free block free_list out of bin bin_index of arena a and allocates
+its first aligned_size bytes, header included. A remainder that can hold a
+block goes back to the bins.
+*/
+__attribute__((always_inline))
+static void *allocate_block(arena_t *a, free_list_t *free_list, int bin_index, uint32_t aligned_size) {
+  delete_node(a, free_list, bin_index);
+  int free_list_size = get_size(free_list) + SIZE_T_SIZE;
+  int size = aligned_size - SIZE_T_SIZE;
+  if (free_list_size - aligned_size >= SMALLEST_BLOCK_SIZE) {
+    split_free_list(a, aligned_size, free_list, free_list_size);
+  } else {
+    size = free_list_size - SIZE_T_SIZE;
+  }
+  mark_not_free(free_list, size);
+  set_size(free_list, size);
+  return (void *) free_list;
+}
+
+/*
+walks the bin of arena a to find and return a memory of size at least size.
+With TLSF, only the first TLSF_FIT_LIMIT blocks of the bin are looked at.
+Large requests are served best-fit from the tree of a.
+Returns NULL if no such memory block exists in the bin.
+*/
+__attribute__((always_inline))
+static void *malloc_from_free_list(arena_t *a, size_t size) {
+  uint32_t aligned_size = align(size) + SIZE_T_SIZE;
+  free_list_t *free_list;
+
+#if TREE_MIN_SIZE
+  if (aligned_size >= TREE_MIN_SIZE) {
+    free_list = tree_best_fit(a, aligned_size - SIZE_T_SIZE);
+    return free_list == NULL ? NULL : allocate_block(a, free_list, 0, aligned_size);
+  }
+#endif
+
+  int bin_index = get_bin(aligned_size);
+  free_list = a->bin[bin_index];
+
+  //tries to find a match in the bin of the best size. 
+#if TLSF
+  for (int tries = 0; free_list != NULL && tries < TLSF_FIT_LIMIT; ++tries) {
+#else
+  while (free_list != NULL) {
+#endif
+    int free_list_size = get_size(free_list) + SIZE_T_SIZE;
+    if (free_list_size >= aligned_size) {
+      return allocate_block(a, free_list, bin_index, aligned_size);
+    }
+    free_list = free_list->next;
+  }
+  
+
+  //any block in a larger non-empty bin fits, so take the head of the first one
+  int i = next_nonempty_bin(a, bin_index);
+  if (i < 0) {
+#if TREE_MIN_SIZE
+    //or else the smallest block of the tree
+    free_list = tree_best_fit(a, aligned_size - SIZE_T_SIZE);
+    if (free_list != NULL) {
+      return allocate_block(a, free_list, 0, aligned_size);
+    }
+#endif
+    //if it didn't find any freelist
+    return NULL;
+  }
+
+  return allocate_block(a, a->bin[i], i, aligned_size);
+}
+
+
+//  heap_malloc - Allocate a block from arena a, incrementing the brk pointer
+//  if needed. Always allocate a block whose size is a multiple of the alignment.
+static void *heap_malloc(arena_t *a, size_t size) {
+  if (size >= HUGE_MIN_SIZE) {
+    return huge_malloc(a, size);
+  }
+#if SLAB_MAX_SIZE
+  if (size <= SLAB_MAX_SIZE) {
+    return slab_malloc(a, size);
+  }
+#endif
+
+  // We allocate a little bit of extra memory so that we can store the
+  // size of the block we've allocated and whether it is free. Take a look 
+  // at realloc to see one example of a place where this can come in handy.
+  size = align(size);
+  uint32_t aligned_size = size + SIZE_T_SIZE;
+  
+  if (aligned_size < SMALLEST_BLOCK_SIZE) {
+    size = SMALLEST_BLOCK_SIZE - SIZE_T_SIZE;
+    aligned_size = SMALLEST_BLOCK_SIZE;
+  }
+
+  void *p;
+#if QUICK_MAX_SIZE
+  if (size <= QUICK_MAX_SIZE) {
+    p = quick_pop(a, size);
+    if (p != NULL) {
+      return p;
+    }
+  }
+#endif
+
+  //first try to allocate from the linked list bin
+  p = malloc_from_free_list(a, size);
+
+  if (p != NULL) {
+    return p;
+  }
+
+#if QUICK_MAX_SIZE
+  //merge the deferred blocks before growing the heap
+  if (a->quick_count != 0) {
+    consolidate(a);
+    p = malloc_from_free_list(a, size);
+    if (p != NULL) {
+      return p;
+    }
+  }
+#endif
+
+  //carve the block out of a free huge block before growing the heap
+  if (a->huge != NULL) {
+    p = huge_carve(a, size);
+    if (p != NULL) {
+      return p;
+    }
+  }
+
+  int took_top = lock_top(a);
+  if (took_top < 0) {
+    unlock_top_of_heap();
+    return NULL;
+  }
+  if (took_top > 0) {
+    //the new run of the arena may already be large enough
+    p = malloc_from_free_list(a, size);
+    if (p != NULL) {
+      unlock_top_of_heap();
+      return p;
+    }
+  }
+
+  //check if the last block in the heap is empty and increase it by the needed size
+  if (is_free_back(a->top)) {
+    int prev_size = get_prev_size(a->top);
+    p = a->top - prev_size - SIZE_T_SIZE;
+    //a bounded TLSF walk may give up before it reaches a top block that fits
+    if (prev_size >= size) {
+      p = allocate_block(a, p, get_bin(prev_size + SIZE_T_SIZE), aligned_size);
+      unlock_top_of_heap();
+      return p;
+    }
+    int req_size = size - prev_size;
+    if (arena_sbrk(a, req_size) == (void *)-1) {
+      unlock_top_of_heap();
+      return NULL;
+    }
+    delete_node(a, (free_list_t *) p, get_bin(prev_size + SIZE_T_SIZE));
+    set_size(p, size);
+    mark_not_free(p, size);
+    unlock_top_of_heap();
+    return p;
+  }
+
+  p = arena_sbrk(a, aligned_size);
+  unlock_top_of_heap();
+
+  if (p == (void *)-1) {
+    // Whoops, an error of some sort occurred.  We return NULL to let
+    // the client code know that we weren't able to allocate memory.
+    return NULL;
+  } else {
+    // We store the size of the block we've allocated in the first
+    // SIZE_T_SIZE bytes and we mark the block not free
+    set_size(p, size);
+    mark_not_free(p, size);
+
+    // Then, we return a pointer to the rest of the block of memory,
+    // which is at least size bytes long.  We have to cast to uint8_t
+    // before we try any pointer arithmetic because voids have no size
+    // and so the compiler doesn't know how far to move the pointer.
+    // Since a uint8_t is always one byte, adding SIZE_T_SIZE after
+    // casting advances the pointer by SIZE_T_SIZE bytes.
+    return (void *) p;
+  }
+}
+
+
+// frees the block pointed to by ptr, which belongs to arena a and is not a
+// slab object, and returns the number of bytes the caller could use in it
+static size_t heap_free_block(arena_t *a, void *ptr) {
+  if (is_huge(ptr)) {
+    size_t size = get_size((char *) ptr - SIZE_T_SIZE);
+    huge_free(a, ptr);
+#if TRIM_THRESHOLD
+    if ((char *) ptr + size == a->top &&
+        size >= __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED)) {
+      trim_top(a, TRIM_PAD);
+    }
+#endif
+    return size - SIZE_T_SIZE;
+  }
+  // the next owner of the block starts without a realloc history. Blocks
+  // recycled through a thread cache keep theirs, since the cache may not
+  // write headers without the arena lock; that at most costs some headroom.
+  int size = get_size(ptr);
+  set_size(ptr, size);
+#if QUICK_MAX_SIZE
+  if (size <= QUICK_MAX_SIZE) {
+    quick_push(a, ptr, size);
+    if (a->quick_count > QUICK_LIMIT) {
+      consolidate(a);
+    }
+    return size;
+  }
+#endif
+  free_block(a, ptr);
+#if TRIM_THRESHOLD
+  //trim only when the block joined the free block at the top, so that an
+  //arena whose top another arena took over does not retry on every free
+  uint32_t top_size = get_prev_size(a->top);
+  if (is_free_back(a->top) &&
+      top_size >= __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED) &&
+      (char *) ptr >= a->top - top_size - SIZE_T_SIZE) {
+    trim_top(a, TRIM_PAD);
+  }
+#endif
+  return size;
+}
+
+// frees the block pointed to by ptr, which belongs to arena a, and returns
+// the number of bytes the caller could use in it
+static size_t heap_free(arena_t *a, void *ptr) {
+#if SLAB_MAX_SIZE
+  int class = slab_class(ptr);
+  if (class != 0) {
+    slab_free(a, ptr, class - 1);
+    return class * ALIGNMENT;
+  }
+#endif
+  return heap_free_block(a, ptr);
+}
+
+// frees the block pointed to by ptr, which belongs to arena a and was
+// allocated for size bytes. Slab objects are only handed out for requests
+// of at most SLAB_MAX_SIZE bytes, so larger blocks skip the class lookup.
+static void heap_free_sized(arena_t *a, void *ptr, size_t size) {
+#if SLAB_MAX_SIZE
+  int class = size <= SLAB_MAX_SIZE ? slab_class(ptr) : 0;
+  if (class != 0) {
+    slab_free(a, ptr, class - 1);
+    return;
+  }
+#else
+  (void) size;
+#endif
+  heap_free_block(a, ptr);
+}
+
+//Gets the number of bytes the caller may use in the allocated block ptr
+static size_t usable_size(void *ptr) {
+#if SLAB_MAX_SIZE
+  int class = slab_class(ptr);
+  if (class != 0) {
+    return class * ALIGNMENT;
+  }
+#endif
+  if (is_huge(ptr)) {
+    return get_size((char *) ptr - SIZE_T_SIZE) - SIZE_T_SIZE;
+  }
+  return get_size(ptr);
+}
+
+/*
+Reallocates ptr of arena a, which is not a slab object, to size bytes when
+the block is huge or size is at least HUGE_MIN_SIZE. A huge block that ends
+at the top of the heap grows in place; other blocks move.
+*/
+static void *huge_realloc(arena_t *a, void *ptr, size_t size) {
+  size_t old_size = usable_size(ptr);
+  size_t new_size = huge_block_size(size) - SIZE_T_SIZE;
+
+  if (is_huge(ptr) && size >= HUGE_MIN_SIZE) {
+    if (new_size <= old_size) {
+      return ptr;
+    }
+    char *block = (char *) ptr - SIZE_T_SIZE;
+    size_t block_size = old_size + SIZE_T_SIZE;
+    if (!has_next(a, block, block_size)) {
+      lock_top_of_heap();
+      if (heap_top == a->top && arena_sbrk(a, new_size - old_size) != (void *)-1) {
+        set_huge(block, new_size + SIZE_T_SIZE);
+        unlock_top_of_heap();
+        return ptr;
+      }
+      unlock_top_of_heap();
+    }
+  }
+
+  void *newptr = heap_malloc(a, size);
+  if (newptr == NULL) {
+    return NULL;
+  }
+  copy_block(newptr, ptr, old_size < new_size ? old_size : new_size);
+  heap_free(a, ptr);
+  return newptr;
+}
+
+// heap_realloc - reallocates a space of size size, and copies the minimum of get_size(ptr) and size amounts 
+//of memory from ptr to the new space. ptr belongs to arena a, and so does the new space.
+static void *heap_realloc(arena_t *a, void *ptr, size_t size) {
+  void *newptr;
+  uint32_t copy_size;
+
+  if (size == 0 || ptr == NULL) {
+     if (ptr != NULL)
+        heap_free(a, ptr);
+     return NULL;
+  }
+
+#if SLAB_MAX_SIZE
+  int class = slab_class(ptr);
+  if (class != 0) {
+    uint32_t obj_size = class * ALIGNMENT;
+    if (size <= obj_size) {
+      return ptr;
+    }
+    newptr = heap_malloc(a, size);
+    if (NULL == newptr) {
+      return NULL;
+    }
+    copy_block(newptr, ptr, obj_size);
+    slab_free(a, ptr, class - 1);
+    return newptr;
+  }
+#endif
+
+  if (size >= HUGE_MIN_SIZE || is_huge(ptr)) {
+    return huge_realloc(a, ptr, size);
+  }
+
+  size = align(size);
+  int aligned_size = size + SIZE_T_SIZE;
+  if (aligned_size < SMALLEST_BLOCK_SIZE) {
+    size = SMALLEST_BLOCK_SIZE - SIZE_T_SIZE;
+    aligned_size = SMALLEST_BLOCK_SIZE;
+  }
+
+  int curr_size = get_size(ptr);
+  int curr_aligned_size = curr_size + SIZE_T_SIZE;
+
+
+  if (curr_size >= size) {
+    int remain_size = curr_size - size;
+#if REALLOC_HEADROOM
+    // keep the headroom of a growing block that is still within it
+    if (is_grown(ptr) && size + size * REALLOC_HEADROOM / 100 >= curr_size) {
+      return ptr;
+    }
+#endif
+    if (remain_size >= SMALLEST_BLOCK_SIZE) {
+      //give the tail back to the heap, merging it with a free next block
+      set_size(ptr, size);
+      mark_not_free(ptr, size);
+      void *remain = (char *) ptr + aligned_size;
+      set_size(remain, remain_size - SIZE_T_SIZE);
+      free_block(a, remain);
+    }
+    return ptr;
+  }
+
+
+  // Get the size of the old block of memory.  Take a peek at heap_malloc(),
+  // where we stashed this in the SIZE_T_SIZE bytes directly before the
+  // address we returned.  Now we can back up by that many bytes and read
+  // the size.
+  copy_size = get_size(ptr);
+
+  // A block that keeps growing is likely to grow again, so it gets room to
+  // do so in place wherever it has to grow into other memory.
+  int grown_size = size;
+#if REALLOC_HEADROOM
+  if (is_grown(ptr)) {
+    grown_size = min(align(size + size * REALLOC_HEADROOM / 100), HUGE_MIN_SIZE);
+  }
+#endif
+
+  if (has_next(a, ptr, curr_size) && is_free_forward(ptr)) {
+    int next_total_size = get_size((void *) ((uint64_t) ptr + curr_aligned_size)) + SIZE_T_SIZE;
+    int remain_size = next_total_size + curr_size - size;
+    if (remain_size >= 0) {
+      delete_node(a, (free_list_t *) ((uint64_t) ptr + curr_aligned_size), get_bin(next_total_size));
+      size = min(grown_size, curr_size + next_total_size);
+      aligned_size = size + SIZE_T_SIZE;
+      remain_size = next_total_size + curr_size - size;
+      if (remain_size >= SMALLEST_BLOCK_SIZE) {
+        split_free_list(a, aligned_size, (free_list_t *) ptr, curr_aligned_size + next_total_size);
+      } else {
+          size = curr_size + next_total_size;
+      }
+      mark_not_free(ptr, size);
+      set_size(ptr, size);
+      mark_grown(ptr);
+      return ptr;
+    }
+  }
+
+
+  //grow the last block of the arena in place if the arena still owns the top of the heap
+  if (!has_next(a, ptr, curr_size)) {
+    lock_top_of_heap();
+    if (heap_top == a->top && arena_sbrk(a, size - curr_size) != (void *)-1) {
+      set_size(ptr, size);
+      mark_not_free(ptr, size);
+      mark_grown(ptr);
+      unlock_top_of_heap();
+      return ptr;
+    }
+    unlock_top_of_heap();
+  }
+
+  //absorb a free previous block, and the next block too if it is free, and
+  //move the data down rather than into a fresh block
+  if ((uint64_t) my_heap_lo() < (uint64_t) ptr - SIZE_T_SIZE && is_free_back(ptr)) {
+    int prev_total_size = get_prev_size(ptr) + SIZE_T_SIZE;
+    int next_total_size = 0;
+    if (has_next(a, ptr, curr_size) && is_free_forward(ptr)) {
+      next_total_size = get_size((void *) ((uint64_t) ptr + curr_aligned_size)) + SIZE_T_SIZE;
+    }
+    int total_size = prev_total_size + curr_aligned_size + next_total_size;
+    if (total_size >= aligned_size && total_size < HUGE_MIN_SIZE) {
+      free_list_t *prev = (free_list_t *) ((uint64_t) ptr - prev_total_size);
+      delete_node(a, prev, get_bin(prev_total_size));
+      if (next_total_size != 0) {
+        delete_node(a, (free_list_t *) ((uint64_t) ptr + curr_aligned_size), get_bin(next_total_size));
+      }
+      if (prev_total_size >= copy_size) {
+        copy_block(prev, ptr, copy_size);
+      } else {
+        memmove(prev, ptr, copy_size);
+      }
+      size = min(grown_size, total_size - SIZE_T_SIZE);
+      aligned_size = size + SIZE_T_SIZE;
+      if (total_size - aligned_size >= SMALLEST_BLOCK_SIZE) {
+        split_free_list(a, aligned_size, prev, total_size);
+      } else {
+        size = total_size - SIZE_T_SIZE;
+      }
+      mark_not_free(prev, size);
+      set_size(prev, size);
+      mark_grown(prev);
+      return prev;
+    }
+  }
+
+  // Allocate a new chunk of memory, and fail if that allocation fails.
+  size = grown_size;
+  newptr = heap_malloc(a, size);
+  if (NULL == newptr) {
+    return NULL;
+  }
+  if (size > SLAB_MAX_SIZE) {
+    mark_grown(newptr);
+  }
+
+  copy_block(newptr, ptr, copy_size);
+
+  // Release the old block.
+  heap_free(a, ptr);
+
+  // Return a pointer to the new block.
+  return newptr;
+}
+
+
+/*
+Allocates size bytes of arena a at a multiple of alignment, a power of
+two. A block with room for an aligned block and a leading fragment is
+allocated, and the fragment before the aligned address and the tail after
+the requested size are returned to the bins.
+
+Returns the aligned pointer, or NULL if the heap cannot grow.
+*/
+static void *heap_memalign(arena_t *a, size_t alignment, size_t size) {
+  if (alignment <= ALIGNMENT) {
+    return heap_malloc(a, size);
+  }
+  if (size > SIZE_MAX - alignment - SMALLEST_BLOCK_SIZE - SLAB_MAX_SIZE) {
+    return NULL;
+  }
+
+  //the fragment must be large enough to be a block, and the block must
+  //not come from a slab run
+  size_t padded = size + alignment + SMALLEST_BLOCK_SIZE;
+  if (padded <= SLAB_MAX_SIZE) {
+    padded = SLAB_MAX_SIZE + 1;
+  }
+  char *p = heap_malloc(a, padded);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  return align_block(a, p, alignment, size);
+}
+
+
+//----------Batches
+
+// Largest block that heap_malloc_batch carves into blocks at once
+#ifndef BATCH_MAX_SIZE
+#define BATCH_MAX_SIZE (256 * 1024)
+#endif
+
+/*
+Allocates n blocks of size bytes from arena a and stores them in out.
+Boundary-tag sizes are served BATCH_MAX_SIZE bytes at a time: one block
+is allocated from the bins or the top of the heap and cut into equal
+blocks in a single pass, so the bins are searched once per group instead
+of once per block.
+
+Returns the number of blocks allocated, which is less than n only if the
+heap cannot grow.
+*/
+static size_t heap_malloc_batch(arena_t *a, size_t size, size_t n, void **out) {
+  //the group block must stay a boundary-tag block
+  int batch_size = min(BATCH_MAX_SIZE, HUGE_MIN_SIZE);
+  size_t done = 0;
+  if (size <= SLAB_MAX_SIZE || size >= (size_t) batch_size / 2) {
+    for (; done < n; ++done) {
+      out[done] = heap_malloc(a, size);
+      if (out[done] == NULL) {
+        break;
+      }
+    }
+    return done;
+  }
+
+  int block_size = max(align(size), SMALLEST_BLOCK_SIZE - SIZE_T_SIZE);
+  int stride = block_size + SIZE_T_SIZE;
+  while (done < n) {
+    size_t group = batch_size / stride;
+    if (group > n - done) {
+      group = n - done;
+    }
+    char *p = heap_malloc(a, group * stride - SIZE_T_SIZE);
+    if (p == NULL) {
+      break;
+    }
+
+    //the last block keeps whatever the group block had beyond the request
+    int last_size = get_size(p) - (group - 1) * stride;
+    for (size_t i = 0; i + 1 < group; ++i) {
+      set_size(p, block_size);
+      mark_not_free(p, block_size);
+      out[done++] = p;
+      p += stride;
+    }
+    set_size(p, last_size);
+    mark_not_free(p, last_size);
+    out[done++] = p;
+  }
+  return done;
+}
+
+//Returns whether the block at ptr is part of the batch being freed
+__attribute__((always_inline))
+static int in_batch(void *ptr) {
+  return ((header_t *) ((uint64_t)ptr - SIZE_T_SIZE))->size & BATCH_FLAG;
+}
+
+/*
+Frees the n blocks of arena a in ptrs, in any order, and overwrites ptrs.
+Blocks that lie next to each other in the heap are merged into runs, and
+each run is coalesced and binned once. No sort is needed: every block is
+flagged first, then each flagged block absorbs the flagged blocks that
+follow it, including runs that were already built from them.
+*/
+static void heap_free_batch(arena_t *a, void **ptrs, size_t n) {
+  size_t m = 0;
+  for (size_t i = 0; i < n; ++i) {
+    char *p = ptrs[i];
+#if SLAB_MAX_SIZE
+    int class = slab_class(p);
+    if (class != 0) {
+      slab_free(a, p, class - 1);
+      continue;
+    }
+#endif
+    if (is_huge(p)) {
+      huge_free(a, p);
+      continue;
+    }
+    ((header_t *) (p - SIZE_T_SIZE))->size |= BATCH_FLAG;
+    ptrs[m++] = p;
+  }
+
+  for (size_t i = 0; i < m; ++i) {
+    char *p = ptrs[i];
+    if (!in_batch(p)) {
+      continue;
+    }
+    int size = get_size(p);
+    while (has_next(a, p, size)) {
+      char *next = p + size + SIZE_T_SIZE;
+      int next_size = get_size(next);
+      if (!in_batch(next) || size + SIZE_T_SIZE + next_size >= HUGE_MIN_SIZE) {
+        break;
+      }
+      set_size(next, next_size);
+      size += SIZE_T_SIZE + next_size;
+#if STATS
+      ++a->coalesces[stats_class(size)];
+#endif
+    }
+    set_size(p, size);
+    ((header_t *) (p - SIZE_T_SIZE))->size |= BATCH_FLAG;
+  }
+
+  //the flags of all runs are read before freeing any, since the links of
+  //a free block may overwrite headers inside it
+  size_t runs = 0;
+  for (size_t i = 0; i < m; ++i) {
+    if (in_batch(ptrs[i])) {
+      set_size(ptrs[i], get_size(ptrs[i]));
+      ptrs[runs++] = ptrs[i];
+    }
+  }
+  for (size_t i = 0; i < runs; ++i) {
+    free_block(a, ptrs[i]);
+  }
+#if TRIM_THRESHOLD
+  //the batch is freed under a single lock hold, so it checks the top once
+  if (is_free_back(a->top) &&
+      get_prev_size(a->top) >= __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED)) {
+    trim_top(a, TRIM_PAD);
+  }
+#endif
+}
+
+//----------End of batches
+
+
+//----------Remote frees
+
+#if THREADS
+
+/*
+A thread that frees a block of another arena does not take that arena's
+lock. It pushes the block onto the arena's remote free list instead, and
+the next thread that allocates from the arena gives the whole list back
+to the bins. Producers push with a CAS and the consumer empties the list
+with a single exchange, so the list needs no ABA protection. A block on
+the list is still allocated as far as the heap is concerned; its first
+word links it into the list.
+*/
+struct remote_block_t {
+  struct remote_block_t *next;
+};
+typedef struct remote_block_t remote_block_t;
+
+//Pushes the chain of blocks from first to last onto the remote free list of arena a
+static void remote_push(arena_t *a, remote_block_t *first, remote_block_t *last) {
+  remote_block_t *head = __atomic_load_n(&a->remote_free, __ATOMIC_RELAXED);
+  do {
+    last->next = head;
+  } while (!__atomic_compare_exchange_n(&a->remote_free, &head, first, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//Frees every block on the remote free list of arena a. Requires the lock of a.
+__attribute__((always_inline))
+static void remote_drain(arena_t *a) {
+  if (__atomic_load_n(&a->remote_free, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+  remote_block_t *block = __atomic_exchange_n(&a->remote_free, NULL, __ATOMIC_ACQUIRE);
+  while (block != NULL) {
+    remote_block_t *next = block->next;
+    heap_free(a, block);
+    block = next;
+  }
+}
+
+#endif
+
+//----------End of remote frees
+
+
+//----------Thread caches
+
+#if THREADS
+
+// Freed blocks with at most TCACHE_MAX_SIZE usable bytes are kept in a
+// per-thread cache, at most TCACHE_COUNT of them per size class.
+#ifndef TCACHE_MAX_SIZE
+#define TCACHE_MAX_SIZE 256
+#endif
+
+#ifndef TCACHE_COUNT
+#define TCACHE_COUNT 32
+#endif
+
+#define TCACHE_CLASSES (TCACHE_MAX_SIZE / ALIGNMENT)
+
+// Number of blocks moved between a thread cache and the heap per lock hold
+#define TCACHE_BATCH (TCACHE_COUNT / 2)
+
+// A cached block is still allocated as far as the heap is concerned. Its
+// first word links it into the cache, which fits even the smallest slab object.
+struct tcache_entry_t {
+  struct tcache_entry_t *next;
+};
+typedef struct tcache_entry_t tcache_entry_t;
+
+struct tcache_t {
+  uint64_t generation;
+  tcache_entry_t *head[TCACHE_CLASSES];
+  uint32_t count[TCACHE_CLASSES];
+};
+typedef struct tcache_t tcache_t;
+
+static __thread tcache_t tcache;
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+
+//Gives the first n blocks of class class_index back to the arenas that own
+//them. Blocks of the calling thread's arena are freed under a single hold of
+//its lock; each run of consecutive blocks of another arena is pushed onto
+//that arena's remote free list at once.
+static void tcache_flush(tcache_t *cache, int class_index, uint32_t n) {
+  arena_t *mine = get_thread_arena();
+  tcache_entry_t *entry = cache->head[class_index];
+  tcache_entry_t *local = NULL;
+  uint32_t i = 0;
+  while (i < n) {
+    arena_t *a = get_arena(entry);
+    tcache_entry_t *first = entry;
+    tcache_entry_t *last = entry;
+    for (entry = entry->next, ++i; i < n && get_arena(entry) == a; entry = entry->next, ++i) {
+      last = entry;
+    }
+    if (a == mine) {
+      last->next = local;
+      local = first;
+    } else {
+      remote_push(a, (remote_block_t *) first, (remote_block_t *) last);
+    }
+  }
+
+  if (local != NULL) {
+    lock_arena(mine);
+    while (local != NULL) {
+      tcache_entry_t *next = local->next;
+      heap_free(mine, local);
+      local = next;
+    }
+    unlock_arena(mine);
+  }
+  cache->head[class_index] = entry;
+  cache->count[class_index] -= n;
+}
+
+//pthread key destructor: returns the cache of an exiting thread to the heap
+static void tcache_destroy(void *arg) {
+  tcache_t *cache = arg;
+  if (cache->generation != heap_generation) {
+    return;
+  }
+  for (int i = 0; i < TCACHE_CLASSES; ++i) {
+    if (cache->count[i] != 0) {
+      tcache_flush(cache, i, cache->count[i]);
+    }
+  }
+}
+
+static void tcache_create_key(void) {
+  pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+//Empties the cache of the calling thread if it belongs to an older heap
+__attribute__((always_inline))
+static void tcache_validate(void) {
+  if (tcache.generation != heap_generation) {
+    memset(&tcache, 0, sizeof(tcache));
+    tcache.generation = heap_generation;
+    pthread_once(&tcache_key_once, tcache_create_key);
+    pthread_setspecific(tcache_key, &tcache);
+  }
+}
+
+/*
+Serves a request of at most TCACHE_MAX_SIZE bytes from the cache of the
+calling thread. An empty class is refilled with TCACHE_BATCH blocks under
+a single hold of the lock of the thread's arena.
+
+Returns NULL if the heap is out of memory.
+*/
+static void *tcache_malloc(size_t size) {
+  int class_index = size == 0 ? 0 : (size - 1) / ALIGNMENT;
+  tcache_validate();
+
+  tcache_entry_t *entry = tcache.head[class_index];
+  if (entry != NULL) {
+    tcache.head[class_index] = entry->next;
+    --tcache.count[class_index];
+    return entry;
+  }
+
+  size_t class_size = (class_index + 1) * ALIGNMENT;
+  arena_t *a = get_thread_arena();
+  lock_arena(a);
+  remote_drain(a);
+  void *p = heap_malloc(a, class_size);
+  for (int i = 1; p != NULL && i < TCACHE_BATCH; ++i) {
+    entry = heap_malloc(a, class_size);
+    if (entry == NULL) {
+      break;
+    }
+    entry->next = tcache.head[class_index];
+    tcache.head[class_index] = entry;
+    ++tcache.count[class_index];
+  }
+  unlock_arena(a);
+  return p;
+}
+
+/*
+Puts ptr, a block of at least size usable bytes, in the cache of the calling
+thread under the class of size. A full class first flushes TCACHE_BATCH
+blocks to the heap.
+*/
+__attribute__((always_inline))
+static void tcache_push(void *ptr, size_t size) {
+  tcache_validate();
+  int class_index = size == 0 ? 0 : (size - 1) / ALIGNMENT;
+  if (tcache.count[class_index] == TCACHE_COUNT) {
+    tcache_flush(&tcache, class_index, TCACHE_BATCH);
+  }
+
+  tcache_entry_t *entry = ptr;
+  entry->next = tcache.head[class_index];
+  tcache.head[class_index] = entry;
+  ++tcache.count[class_index];
+}
+
+#endif
+
+//----------End of thread caches
+
+
+//----------Statistics
+
+#if STATS
+
+// The live bytes of a thread are added to stats_live once they drift this
+// far from zero, so the peak may lag by this much per thread
+#define STATS_FLUSH_BYTES (64 * 1024)
+
+/*
+The counters of the public calls of one thread. Only that thread writes
+them, with relaxed atomic stores instead of locked increments, so that
+my_malloc_stats can read them at any time. Live bytes are the usable
+bytes allocated minus the usable bytes freed, not yet added to stats_live.
+*/
+struct thread_stats_t {
+  uint64_t mallocs[MALLOC_STATS_CLASSES];
+  uint64_t frees[MALLOC_STATS_CLASSES];
+  int64_t live;
+#if THREADS
+  struct thread_stats_t *prev;
+  struct thread_stats_t *next;
+  uint8_t registered;
+#endif
+};
+typedef struct thread_stats_t thread_stats_t;
+
+#if THREADS
+static __thread thread_stats_t thread_stats;
+#else
+static thread_stats_t thread_stats;
+#endif
+
+//the live bytes that threads have flushed, and their highest value
+int64_t stats_live;
+int64_t stats_peak;
+
+#if THREADS
+//Protects the list of registered threads and retired_stats
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//the counters of every thread that has made a call since it started
+static thread_stats_t *stats_threads;
+
+//the counters of exited threads
+static thread_stats_t retired_stats;
+
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+
+//pthread key destructor: folds the counters of an exiting thread into retired_stats
+static void stats_retire(void *arg) {
+  thread_stats_t *stats = arg;
+  pthread_mutex_lock(&stats_lock);
+  if (stats->prev != NULL) {
+    stats->prev->next = stats->next;
+  } else {
+    stats_threads = stats->next;
+  }
+  if (stats->next != NULL) {
+    stats->next->prev = stats->prev;
+  }
+  for (int i = 0; i < MALLOC_STATS_CLASSES; ++i) {
+    retired_stats.mallocs[i] += stats->mallocs[i];
+    retired_stats.frees[i] += stats->frees[i];
+  }
+  __atomic_fetch_add(&stats_live, stats->live, __ATOMIC_RELAXED);
+  memset(stats, 0, sizeof(*stats));
+  pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_create_key(void) {
+  pthread_key_create(&stats_key, stats_retire);
+}
+
+//Adds the counters of the calling thread to the list that my_malloc_stats reads
+static void stats_register(void) {
+  pthread_once(&stats_key_once, stats_create_key);
+  pthread_setspecific(stats_key, &thread_stats);
+  pthread_mutex_lock(&stats_lock);
+  thread_stats.prev = NULL;
+  thread_stats.next = stats_threads;
+  if (stats_threads != NULL) {
+    stats_threads->prev = &thread_stats;
+  }
+  stats_threads = &thread_stats;
+  thread_stats.registered = 1;
+  pthread_mutex_unlock(&stats_lock);
+}
+#endif
+
+//Adds n to a counter of the calling thread. Only threads need the atomic
+//store, which keeps the compiler from holding the counter in a register.
+__attribute__((always_inline))
+static void stats_add(uint64_t *counter, int64_t n) {
+#if THREADS
+  __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+#else
+  *counter += n;
+#endif
+}
+
+//Moves the live bytes of the calling thread to stats_live and updates the peak
+__attribute__((always_inline))
+static void stats_flush(void) {
+#if THREADS
+  int64_t live = __atomic_add_fetch(&stats_live, thread_stats.live, __ATOMIC_RELAXED);
+  __atomic_store_n(&thread_stats.live, 0, __ATOMIC_RELAXED);
+  int64_t peak = __atomic_load_n(&stats_peak, __ATOMIC_RELAXED);
+  while (live > peak && !__atomic_compare_exchange_n(&stats_peak, &peak, live, 1,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+#else
+  stats_live += thread_stats.live;
+  thread_stats.live = 0;
+  if (stats_live > stats_peak) {
+    stats_peak = stats_live;
+  }
+#endif
+}
+
+//Zeroes every counter for a new heap. No other call may run at the same time.
+static void stats_reset(void) {
+#if THREADS
+  pthread_mutex_lock(&stats_lock);
+  for (thread_stats_t *stats = stats_threads; stats != NULL; stats = stats->next) {
+    memset(stats->mallocs, 0, sizeof(stats->mallocs));
+    memset(stats->frees, 0, sizeof(stats->frees));
+    stats->live = 0;
+  }
+  memset(&retired_stats, 0, sizeof(retired_stats));
+  pthread_mutex_unlock(&stats_lock);
+#else
+  memset(&thread_stats, 0, sizeof(thread_stats));
+#endif
+  stats_live = 0;
+  stats_peak = 0;
+}
+
+//Adds the free blocks of arena a to stats->free_bytes
+static void stats_free_blocks(arena_t *a, my_malloc_stats_t *stats) {
+  for (int i = 0; i < BIN_SIZE; ++i) {
+    for (free_list_t *block = a->bin[i]; block != NULL; block = block->next) {
+      stats->free_bytes[stats_class(get_size(block))] += get_size(block);
+    }
+  }
+#if TREE_MIN_SIZE
+  //walks the tree in order with the parent links
+  tree_node_t *node = a->tree;
+  while (node != NULL && node->left != NULL) {
+    node = node->left;
+  }
+  while (node != NULL) {
+    stats->free_bytes[stats_class(get_size(node))] += get_size(node);
+    if (node->right != NULL) {
+      node = node->right;
+      while (node->left != NULL) {
+        node = node->left;
+      }
+    } else {
+      while (node->parent != NULL && node->parent->right == node) {
+        node = node->parent;
+      }
+      node = node->parent;
+    }
+  }
+#endif
+#if QUICK_MAX_SIZE
+  for (int i = 0; i < QUICK_CLASSES; ++i) {
+    for (free_list_t *block = a->quick[i]; block != NULL; block = block->next) {
+      stats->free_bytes[stats_class(get_size(block))] += get_size(block);
+    }
+  }
+#endif
+  for (free_list_t *block = a->huge; block != NULL; block = block->next) {
+    size_t size = usable_size(block);
+    stats->free_bytes[stats_class(size)] += size;
+  }
+}
+
+
+/*
+Gets the usable size of the block ptr that was handed out for a request of
+size bytes. Slab objects only serve requests of at most SLAB_MAX_SIZE bytes,
+so larger blocks skip the lookup of their slab class. So do the smaller ones
+that fresh says heap_malloc returned, since size gives their class.
+*/
+__attribute__((always_inline))
+static size_t stats_size(void *ptr, size_t size, uint8_t fresh) {
+#if SLAB_MAX_SIZE
+  if (size <= SLAB_MAX_SIZE) {
+    if (!fresh) {
+      return usable_size(ptr);
+    }
+    return size == 0 ? ALIGNMENT : (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+#else
+  (void) size;
+  (void) fresh;
+#endif
+  if (is_huge(ptr)) {
+    return get_size((char *) ptr - SIZE_T_SIZE) - SIZE_T_SIZE;
+  }
+  return get_size(ptr);
+}
+
+//Records that the calling thread got a block of size usable bytes
+__attribute__((always_inline))
+static void stats_malloc(size_t size) {
+#if THREADS
+  if (!thread_stats.registered) {
+    stats_register();
+  }
+#endif
+  stats_add(&thread_stats.mallocs[stats_class(size)], 1);
+  stats_add((uint64_t *) &thread_stats.live, size);
+  if (thread_stats.live > STATS_FLUSH_BYTES) {
+    stats_flush();
+  }
+}
+
+//Records that the calling thread frees a block of size usable bytes
+__attribute__((always_inline))
+static void stats_free(size_t size) {
+#if THREADS
+  if (!thread_stats.registered) {
+    stats_register();
+  }
+#endif
+  stats_add(&thread_stats.frees[stats_class(size)], 1);
+  stats_add((uint64_t *) &thread_stats.live, -(int64_t) size);
+  if (thread_stats.live < -STATS_FLUSH_BYTES) {
+    stats_flush();
+  }
+}
+
+#endif
+
+//----------End of statistics
+
+
+//----------Heap profile
+
+#if PROFILE_SAMPLE_BYTES
+
+// Slots of the table of sampled blocks; a power of two
+#ifndef PROFILE_TABLE_SIZE
+#define PROFILE_TABLE_SIZE 4096
+#endif
+
+// Deepest call stack recorded for a sample
+#define PROFILE_DEPTH 32
+
+// Longest run of slots that a lookup in the table walks
+#define PROFILE_PROBES 64
+
+// Values of profile_keys for a slot that was never used or whose sample
+// was removed
+#define PROFILE_EMPTY 0
+#define PROFILE_REMOVED 1
+
+//A sampled block: the request size and the call stack that allocated it
+struct profile_sample_t {
+  size_t size;
+  int depth;
+  void *stack[PROFILE_DEPTH];
+};
+typedef struct profile_sample_t profile_sample_t;
+
+/*
+The sampled blocks form an open-addressing table: profile_keys[i] is the
+address of the block whose sample is profile_samples[i]. The keys are kept
+apart so that the lookups of every free stay within a few cache lines.
+Keys are accessed atomically and may be read without profile_lock: a free
+looks up its block without the lock, and takes the lock only if it finds
+a sample. A slot is published by storing its key after its sample.
+*/
+static uint64_t profile_keys[PROFILE_TABLE_SIZE];
+static profile_sample_t profile_samples[PROFILE_TABLE_SIZE];
+
+//number of samples in the table, so that frees skip the lookup while it is 0
+static uint32_t profile_count;
+
+#if THREADS
+//Protects the table, except for the lookups of keys by profile_free
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//bytes the calling thread still allocates before its next sample, and the
+//state of the generator that draws the distances between samples
+static __thread int64_t profile_countdown;
+static __thread uint64_t profile_random;
+#else
+static int64_t profile_countdown;
+static uint64_t profile_random;
+#endif
+
+//Gets the first slot of the table to look at for ptr
+__attribute__((always_inline))
+static uint32_t profile_slot(void *ptr) {
+  return ((uint64_t) ptr >> 3) * 0x9E3779B97F4A7C15ull >> 32 & (PROFILE_TABLE_SIZE - 1);
+}
+
+/*
+Draws the number of bytes until the next sample of the calling thread from
+an exponential distribution with mean PROFILE_SAMPLE_BYTES. Every byte is
+then sampled with the same probability, whatever the sizes of the requests
+around it, and periodic allocation patterns do not alias with the sampling.
+*/
+static int64_t profile_next(void) {
+  if (profile_random == 0) {
+    profile_random = (uint64_t) &profile_countdown | 1;
+  }
+  profile_random ^= profile_random << 13;
+  profile_random ^= profile_random >> 7;
+  profile_random ^= profile_random << 17;
+  double u = ((profile_random >> 11) + 1) * (1.0 / 9007199254740992.0);
+  return (int64_t) (-log(u) * PROFILE_SAMPLE_BYTES) + 1;
+}
+
+//Records a sample for the block ptr of a request of size bytes, with the
+//call stack of the caller. The sample is dropped if the table is too full.
+static void profile_record(void *ptr, size_t size) {
+  void *stack[PROFILE_DEPTH];
+  int depth = backtrace(stack, PROFILE_DEPTH);
+
+#if THREADS
+  pthread_mutex_lock(&profile_lock);
+#endif
+  uint32_t slot = profile_slot(ptr);
+  for (int i = 0; i < PROFILE_PROBES; ++i, slot = (slot + 1) & (PROFILE_TABLE_SIZE - 1)) {
+    if (profile_keys[slot] == PROFILE_EMPTY || profile_keys[slot] == PROFILE_REMOVED) {
+      profile_sample_t *sample = &profile_samples[slot];
+      sample->size = size;
+      sample->depth = depth;
+      memcpy(sample->stack, stack, depth * sizeof(void *));
+      __atomic_store_n(&profile_keys[slot], (uint64_t) ptr, __ATOMIC_RELEASE);
+      __atomic_store_n(&profile_count, profile_count + 1, __ATOMIC_RELAXED);
+      break;
+    }
+  }
+#if THREADS
+  pthread_mutex_unlock(&profile_lock);
+#endif
+}
+
+//Gets the slot of the sample of the block ptr, or -1 if it has none
+static int profile_find(void *ptr) {
+  uint32_t slot = profile_slot(ptr);
+  for (int i = 0; i < PROFILE_PROBES; ++i, slot = (slot + 1) & (PROFILE_TABLE_SIZE - 1)) {
+    uint64_t entry = __atomic_load_n(&profile_keys[slot], __ATOMIC_RELAXED);
+    if (entry == PROFILE_EMPTY) {
+      return -1;
+    }
+    if (entry == (uint64_t) ptr) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+//Removes the sample of the block ptr, if there is one
+static void profile_remove(void *ptr) {
+  int found = profile_find(ptr);
+  if (found < 0) {
+    return;
+  }
+  uint32_t slot = found;
+
+#if THREADS
+  pthread_mutex_lock(&profile_lock);
+#endif
+  //a slot followed by an empty one ends every chain through it, so it can
+  //become empty itself, and so can the removed slots before it
+  uint32_t next = (slot + 1) & (PROFILE_TABLE_SIZE - 1);
+  if (profile_keys[next] == PROFILE_EMPTY) {
+    __atomic_store_n(&profile_keys[slot], PROFILE_EMPTY, __ATOMIC_RELAXED);
+    for (slot = (slot - 1) & (PROFILE_TABLE_SIZE - 1); profile_keys[slot] == PROFILE_REMOVED;
+         slot = (slot - 1) & (PROFILE_TABLE_SIZE - 1)) {
+      __atomic_store_n(&profile_keys[slot], PROFILE_EMPTY, __ATOMIC_RELAXED);
+    }
+  } else {
+    __atomic_store_n(&profile_keys[slot], PROFILE_REMOVED, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&profile_count, profile_count - 1, __ATOMIC_RELAXED);
+#if THREADS
+  pthread_mutex_unlock(&profile_lock);
+#endif
+}
+
+//Forgets every sample for a new heap. No other call may run at the same time.
+static void profile_reset(void) {
+  memset(profile_keys, 0, sizeof(profile_keys));
+  profile_count = 0;
+}
+
+//Counts size bytes against the sampling distance of the calling thread.
+//Returns whether they reach the next sample.
+__attribute__((always_inline))
+static int profile_charge(size_t size) {
+  profile_countdown -= size;
+  if (__builtin_expect(profile_countdown > 0, 1)) {
+    return 0;
+  }
+  int first = profile_random == 0;
+  profile_countdown = profile_next();
+  //the first call of a thread only starts its countdown
+  return !first;
+}
+
+//Counts a request of size bytes that got the block ptr against the
+//sampling distance of the calling thread
+__attribute__((always_inline))
+static void profile_malloc(void *ptr, size_t size) {
+  if (profile_charge(size)) {
+    profile_record(ptr, size);
+  }
+}
+
+/*
+Updates the sample of the block ptr, which realloc resized in place from
+old_size usable bytes for a request of size bytes, and counts only its
+growth against the sampling distance of the calling thread. A block that
+has no sample gets one if its growth reaches the next sample.
+*/
+static void profile_resize(void *ptr, size_t old_size, size_t size) {
+  int slot = -1;
+  if (__atomic_load_n(&profile_count, __ATOMIC_RELAXED) != 0) {
+    slot = profile_find(ptr);
+  }
+  if (slot >= 0) {
+#if THREADS
+    pthread_mutex_lock(&profile_lock);
+#endif
+    if (profile_keys[slot] == (uint64_t) ptr) {
+      profile_samples[slot].size = size;
+    }
+#if THREADS
+    pthread_mutex_unlock(&profile_lock);
+#endif
+  }
+  if (size > old_size && profile_charge(size - old_size) && slot < 0) {
+    profile_record(ptr, size);
+  }
+}
+
+//Removes the sample of the block ptr if it has one
+__attribute__((always_inline))
+static void profile_free(void *ptr) {
+  if (__atomic_load_n(&profile_count, __ATOMIC_RELAXED) != 0) {
+    profile_remove(ptr);
+  }
+}
+
+#endif
+
+//----------End of heap profile
+
+
+/*
+Records for my_malloc_stats and the heap profile that the calling thread got
+the block ptr, which may be NULL, for a request of size bytes. fresh says
+that heap_malloc returned ptr, see stats_size.
+
+Returns ptr.
+*/
+__attribute__((always_inline))
+static void *record_malloc(void *ptr, size_t size, uint8_t fresh) {
+  if (ptr == NULL) {
+    return ptr;
+  }
+#if STATS
+  stats_malloc(stats_size(ptr, size, fresh));
+#endif
+#if PROFILE_SAMPLE_BYTES
+  profile_malloc(ptr, size);
+#endif
+  (void) size;
+  (void) fresh;
+  return ptr;
+}
+
+//Records for my_malloc_stats and the heap profile that the calling thread
+//frees the block ptr, which may be NULL, of size usable bytes, or of a size
+//to look up if size is 0
+__attribute__((always_inline))
+static void record_free(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+#if STATS
+  stats_free(size != 0 ? size : usable_size(ptr));
+#endif
+#if PROFILE_SAMPLE_BYTES
+  profile_free(ptr);
+#endif
+  (void) size;
+}
+
+#if STATS || PROFILE_SAMPLE_BYTES
+//Records for my_malloc_stats and the heap profile that realloc resized the
+//block ptr of old_size usable bytes in place for a request of size bytes
+__attribute__((always_inline))
+static void record_resize(void *ptr, size_t old_size, size_t size) {
+#if STATS
+  stats_free(old_size);
+  stats_malloc(stats_size(ptr, size, 0));
+#endif
+#if PROFILE_SAMPLE_BYTES
+  profile_resize(ptr, old_size, size);
+#endif
+}
+#endif
+
+
+//Gets the number of bytes the caller may use in the block ptr, or 0 for NULL
+size_t my_malloc_usable_size(void *ptr) {
+  return ptr == NULL ? 0 : usable_size(ptr);
+}
+
+void *my_malloc(size_t size) {
+#if THREADS
+  if (size <= TCACHE_MAX_SIZE) {
+    return record_malloc(tcache_malloc(size), size, 0);
+  }
+#endif
+  arena_t *a = get_thread_arena();
+  lock_arena(a);
+#if THREADS
+  remote_drain(a);
+#endif
+  void *p = heap_malloc(a, size);
+  unlock_arena(a);
+  return record_malloc(p, size, 1);
+}
+
+// frees ptr into the arena that owns it, whichever thread allocated it
+void my_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+#if THREADS
+  //the size that picks the class of the thread cache also saves the heap
+  //the lookup of the slab class of larger blocks
+  size_t size = usable_size(ptr);
+  record_free(ptr, size);
+  if (size <= TCACHE_MAX_SIZE) {
+    tcache_push(ptr, size);
+    return;
+  }
+  arena_t *a = get_arena(ptr);
+  if (a != get_thread_arena()) {
+    remote_push(a, ptr, ptr);
+    return;
+  }
+  lock_arena(a);
+  heap_free_sized(a, ptr, size);
+  unlock_arena(a);
+#else
+  arena_t *a = get_arena(ptr);
+  lock_arena(a);
+  size_t size = heap_free(a, ptr);
+  unlock_arena(a);
+  record_free(ptr, size);
+#endif
+}
+
+/*
+Frees ptr, which was allocated or last reallocated for size bytes. The
+size saves the thread cache the lookup of the block's capacity and the
+heap the lookup of the slab class. Debug builds check it against the block.
+*/
+void my_free_sized(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+  assert(size <= usable_size(ptr));
+#if SLAB_MAX_SIZE
+  assert(size <= SLAB_MAX_SIZE || slab_class(ptr) == 0);
+#endif
+  record_free(ptr, 0);
+#if THREADS
+  if (size <= TCACHE_MAX_SIZE) {
+    tcache_push(ptr, size);
+    return;
+  }
+#endif
+  arena_t *a = get_arena(ptr);
+#if THREADS
+  if (a != get_thread_arena()) {
+    remote_push(a, ptr, ptr);
+    return;
+  }
+#endif
+  lock_arena(a);
+  heap_free_sized(a, ptr, size);
+  unlock_arena(a);
+}
+
+/*
+Counts as a free of ptr and a malloc of the result for my_malloc_stats. A
+block that is resized in place keeps its sample in the heap profile, and
+only its growth counts towards the next sample.
+*/
+void *my_realloc(void *ptr, size_t size) {
+#if STATS || PROFILE_SAMPLE_BYTES
+  size_t old_size = ptr == NULL ? 0 : usable_size(ptr);
+#endif
+  arena_t *a = ptr == NULL ? get_thread_arena() : get_arena(ptr);
+  lock_arena(a);
+#if THREADS
+  remote_drain(a);
+#endif
+  void *p = heap_realloc(a, ptr, size);
+#if STATS || PROFILE_SAMPLE_BYTES
+  //a block that moved or was freed is recorded under the lock, before
+  //another thread can get its address. A failed realloc leaves it allocated.
+  if (ptr != NULL && p != ptr && (p != NULL || size == 0)) {
+    record_free(ptr, old_size);
+  }
+#endif
+  unlock_arena(a);
+#if STATS || PROFILE_SAMPLE_BYTES
+  if (p != NULL && p == ptr) {
+    record_resize(p, old_size, size);
+  } else {
+    record_malloc(p, size, 0);
+  }
+#endif
+  return p;
+}
+
+/*
+Allocates size bytes like my_malloc, and stores in *actual the number of
+bytes the caller may use, which includes the rounding to the block size.
+
+Returns the pointer, or NULL if the heap cannot grow.
+*/
+void *my_malloc_sized(size_t size, size_t *actual) {
+  void *p = my_malloc(size);
+  if (p != NULL) {
+    *actual = usable_size(p);
+  }
+  return p;
+}
+
+/*
+Allocates nmemb * size zeroed bytes. Only the part of the block that was
+used before is cleared: memory that the call gets from mem_sbrk for the
+first time is still zero.
+
+Returns the pointer, or NULL if the size overflows or the heap cannot grow.
+*/
+void *my_calloc(size_t nmemb, size_t size) {
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    return NULL;
+  }
+  size_t clear_size = (total + 7) & ~(size_t) 7;
+#if THREADS
+  if (total <= TCACHE_MAX_SIZE) {
+    void *p = tcache_malloc(total);
+    if (p != NULL) {
+      clear_block(p, clear_size);
+    }
+    return record_malloc(p, total, 0);
+  }
+#endif
+  arena_t *a = get_thread_arena();
+  lock_arena(a);
+#if THREADS
+  remote_drain(a);
+#endif
+  a->fresh = (char *) UINTPTR_MAX;
+  char *p = heap_malloc(a, total);
+  char *fresh = a->fresh;
+  unlock_arena(a);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  //slab runs keep their links in the free slots
+  if (total > SLAB_MAX_SIZE && fresh < p + clear_size) {
+    clear_size = fresh > p ? (size_t) (fresh - p) : 0;
+  }
+  clear_block(p, clear_size);
+  return record_malloc(p, total, 1);
+}
+
+/*
+Fills stats with the counters of all threads and arenas since my_init.
+Requests count in the class of the usable size of their block, and blocks
+in thread caches count as live. The peak is the highest sum of the live
+bytes that threads have flushed, see STATS_FLUSH_BYTES.
+
+Returns 0, or -1 if the allocator was built without STATS.
+*/
+int my_malloc_stats(my_malloc_stats_t *stats) {
+#if STATS
+  memset(stats, 0, sizeof(*stats));
+  int64_t live = __atomic_load_n(&stats_live, __ATOMIC_RELAXED);
+#if THREADS
+  pthread_mutex_lock(&stats_lock);
+  for (int i = 0; i < MALLOC_STATS_CLASSES; ++i) {
+    stats->mallocs[i] = retired_stats.mallocs[i];
+    stats->frees[i] = retired_stats.frees[i];
+  }
+  for (thread_stats_t *t = stats_threads; t != NULL; t = t->next) {
+    for (int i = 0; i < MALLOC_STATS_CLASSES; ++i) {
+      stats->mallocs[i] += __atomic_load_n(&t->mallocs[i], __ATOMIC_RELAXED);
+      stats->frees[i] += __atomic_load_n(&t->frees[i], __ATOMIC_RELAXED);
+    }
+    live += __atomic_load_n(&t->live, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&stats_lock);
+#else
+  for (int i = 0; i < MALLOC_STATS_CLASSES; ++i) {
+    stats->mallocs[i] = thread_stats.mallocs[i];
+    stats->frees[i] = thread_stats.frees[i];
+  }
+  live += thread_stats.live;
+#endif
+  int64_t peak = __atomic_load_n(&stats_peak, __ATOMIC_RELAXED);
+  stats->live_bytes = live > 0 ? live : 0;
+  stats->peak_live_bytes = peak > live ? peak : stats->live_bytes;
+
+  for (int k = 0; k < ARENAS; ++k) {
+    arena_t *a = &arenas[k];
+    lock_arena(a);
+    for (int i = 0; i < MALLOC_STATS_CLASSES; ++i) {
+      stats->splits[i] += a->splits[i];
+      stats->coalesces[i] += a->coalesces[i];
+    }
+    stats->sbrk_calls += a->sbrk_calls;
+    stats->sbrk_bytes += a->sbrk_bytes;
+    stats_free_blocks(a, stats);
+    unlock_arena(a);
+  }
+  return 0;
+#else
+  (void) stats;
+  return -1;
+#endif
+}
+
+/*
+Gives free memory back: the free blocks at the top of the heap go back to
+memlib, except for their first pad bytes, and with MEM_MMAP the whole pages
+inside the other free blocks go back to the system. Blocks held by thread
+caches stay allocated.
+
+Returns 1 if any memory was given back, or else 0.
+*/
+int my_malloc_trim(size_t pad) {
+  size_t released = 0;
+  for (int k = 0; k < ARENAS; ++k) {
+    arena_t *a = &arenas[k];
+    lock_arena(a);
+#if THREADS
+    remote_drain(a);
+#endif
+#if QUICK_MAX_SIZE
+    consolidate(a);
+#endif
+    released += trim_top(a, pad);
+#if MEM_MMAP
+    released += release_free_blocks(a, UINT64_MAX);
+#endif
+    unlock_arena(a);
+  }
+  return released != 0;
+}
+
+/*
+Starts the scavenger thread, see SCAVENGE_DECAY_MS. It must be stopped
+before memlib frees the heap.
+
+Returns 0, or -1 if it runs already, cannot be started, or the allocator
+was built without it.
+*/
+int my_scavenger_start(void) {
+#if SCAVENGE_DECAY_MS
+  pthread_mutex_lock(&scavenge_lock);
+  int result = -1;
+  if (!scavenge_running) {
+    scavenge_running = 1;
+    result = pthread_create(&scavenge_thread, NULL, scavenge, NULL) == 0 ? 0 : -1;
+    scavenge_running = result == 0;
+  }
+  pthread_mutex_unlock(&scavenge_lock);
+  return result;
+#else
+  return -1;
+#endif
+}
+
+//Stops the scavenger thread and waits for it, if it runs
+void my_scavenger_stop(void) {
+#if SCAVENGE_DECAY_MS
+  pthread_mutex_lock(&scavenge_lock);
+  uint8_t running = scavenge_running;
+  scavenge_running = 0;
+  pthread_cond_signal(&scavenge_cond);
+  pthread_mutex_unlock(&scavenge_lock);
+  if (running) {
+    pthread_join(scavenge_thread, NULL);
+  }
+#endif
+}
+
+/*
+Writes the sampled blocks that are still allocated to out as a heap profile
+in the text format of gperftools, which pprof reads: one line per call stack
+with the number and bytes of its samples, then the memory map of the
+process. pprof scales the samples up by the sampling rate in the header.
+
+Returns 0, or -1 if the allocator was built without PROFILE_SAMPLE_BYTES.
+*/
+int my_malloc_profile(FILE *out) {
+#if PROFILE_SAMPLE_BYTES
+#if THREADS
+  pthread_mutex_lock(&profile_lock);
+#endif
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  for (int i = 0; i < PROFILE_TABLE_SIZE; ++i) {
+    if (profile_keys[i] > PROFILE_REMOVED) {
+      ++count;
+      bytes += profile_samples[i].size;
+    }
+  }
+  fprintf(out, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n",
+          (unsigned long long) count, (unsigned long long) bytes,
+          (unsigned long long) count, (unsigned long long) bytes,
+          (unsigned long long) PROFILE_SAMPLE_BYTES);
+
+  //adds up the samples of each call stack at its first sample
+  uint8_t done[PROFILE_TABLE_SIZE] = {0};
+  for (int i = 0; i < PROFILE_TABLE_SIZE; ++i) {
+    profile_sample_t *sample = &profile_samples[i];
+    if (profile_keys[i] <= PROFILE_REMOVED || done[i]) {
+      continue;
+    }
+    count = 0;
+    bytes = 0;
+    for (int j = i; j < PROFILE_TABLE_SIZE; ++j) {
+      profile_sample_t *other = &profile_samples[j];
+      if (profile_keys[j] > PROFILE_REMOVED && !done[j] && other->depth == sample->depth &&
+          memcmp(other->stack, sample->stack, sample->depth * sizeof(void *)) == 0) {
+        done[j] = 1;
+        ++count;
+        bytes += other->size;
+      }
+    }
+    fprintf(out, "%6llu: %8llu [%6llu: %8llu] @", (unsigned long long) count,
+            (unsigned long long) bytes, (unsigned long long) count,
+            (unsigned long long) bytes);
+    for (int k = 0; k < sample->depth; ++k) {
+      fprintf(out, " %p", sample->stack[k]);
+    }
+    fprintf(out, "\n");
+  }
+#if THREADS
+  pthread_mutex_unlock(&profile_lock);
+#endif
+
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps != NULL) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) {
+      fwrite(buf, 1, n, out);
+    }
+    fclose(maps);
+  }
+  return 0;
+#else
+  (void) out;
+  return -1;
+#endif
+}
+
+/*
+Allocates n blocks of size bytes and stores them in out. Blocks that
+cannot be allocated are left out of out.
+
+Returns the number of blocks allocated.
+*/
+size_t my_malloc_batch(size_t size, size_t n, void **out) {
+  arena_t *a = get_thread_arena();
+  lock_arena(a);
+#if THREADS
+  remote_drain(a);
+#endif
+  size_t done = heap_malloc_batch(a, size, n, out);
+  unlock_arena(a);
+  for (size_t i = 0; i < done; ++i) {
+    record_malloc(out[i], size, 1);
+  }
+  return done;
+}
+
+/*
+Frees the n blocks in ptrs, which may contain NULL, and overwrites ptrs.
+Blocks of other arenas are pushed onto their remote free lists as one
+chain per arena; the blocks of the calling thread's arena are freed under
+a single lock hold, with adjacent blocks merged before they are binned.
+*/
+void my_free_batch(void **ptrs, size_t n) {
+  arena_t *a = get_thread_arena();
+#if THREADS
+  remote_block_t *first[ARENAS] = {NULL};
+  remote_block_t *last[ARENAS];
+#endif
+  size_t m = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (ptrs[i] == NULL) {
+      continue;
+    }
+    record_free(ptrs[i], 0);
+#if THREADS
+    arena_t *owner = get_arena(ptrs[i]);
+    if (owner != a) {
+      remote_block_t *block = ptrs[i];
+      int k = owner - arenas;
+      block->next = first[k];
+      if (first[k] == NULL) {
+        last[k] = block;
+      }
+      first[k] = block;
+      continue;
+    }
+#endif
+    ptrs[m++] = ptrs[i];
+  }
+#if THREADS
+  for (int k = 0; k < ARENAS; ++k) {
+    if (first[k] != NULL) {
+      remote_push(&arenas[k], first[k], last[k]);
+    }
+  }
+#endif
+
+  if (m == 0) {
+    return;
+  }
+  lock_arena(a);
+#if THREADS
+  remote_drain(a);
+#endif
+  heap_free_batch(a, ptrs, m);
+  unlock_arena(a);
+}
+
+/*
+Allocates size bytes at a multiple of alignment, which must be a power of
+two.
+
+Returns the pointer, or NULL if alignment is not a power of two or the
+heap cannot grow.
+*/
+void *my_memalign(size_t alignment, size_t size) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    return NULL;
+  }
+  arena_t *a = get_thread_arena();
+  lock_arena(a);
+#if THREADS
+  remote_drain(a);
+#endif
+  void *p = heap_memalign(a, alignment, size);
+  unlock_arena(a);
+  return record_malloc(p, size, 0);
+}
+
+//C11 aligned_alloc, see my_memalign
+void *my_aligned_alloc(size_t alignment, size_t size) {
+  return my_memalign(alignment, size);
+}
+
+/*
+POSIX posix_memalign: stores in *memptr a pointer to size bytes at a
+multiple of alignment, which must be a power of two multiple of
+sizeof(void *).
+
+Returns 0, EINVAL for a bad alignment or ENOMEM if the heap cannot grow.
+*/
+int my_posix_memalign(void **memptr, size_t alignment, size_t size) {
+  if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void *p = my_memalign(alignment, size);
+  if (p == NULL) {
+    return ENOMEM;
+  }
+  *memptr = p;
+  return 0;
+}
+
+
+//----------Regions
+
+// Bytes a region takes from the heap at a time
+#ifndef REGION_CHUNK_SIZE
+#define REGION_CHUNK_SIZE (64 * 1024)
+#endif
+
+/*
+A chunk of a region is an ordinary heap block. Its first word links it to
+the chunk allocated before it; the rest is handed out by bumping cur.
+*/
+struct region_chunk_t {
+  struct region_chunk_t *next;
+};
+typedef struct region_chunk_t region_chunk_t;
+
+struct region_t {
+  char *cur;
+  char *end;
+  region_chunk_t *chunks;
+};
+
+/*
+Creates an empty region. Its chunks are taken from the arena of the
+calling thread, but a region must only be used by one thread at a time.
+
+Returns the region, or NULL if the heap cannot grow.
+*/
+region_t *region_create(void) {
+  region_t *r = my_malloc(sizeof(region_t));
+  if (r != NULL) {
+    r->cur = NULL;
+    r->end = NULL;
+    r->chunks = NULL;
+  }
+  return r;
+}
+
+/*
+Adds a chunk of at least size usable bytes to r. Requests larger than a
+quarter of REGION_CHUNK_SIZE get a chunk of their own, so that the
+current chunk keeps serving small requests.
+
+Returns the first size bytes of the chunk, or NULL if the heap cannot grow.
+*/
+static char *region_grow(region_t *r, size_t size) {
+  size_t chunk_size = sizeof(region_chunk_t) + size;
+  int own = size > REGION_CHUNK_SIZE / 4;
+  if (!own) {
+    chunk_size = REGION_CHUNK_SIZE;
+  }
+  size_t actual;
+  region_chunk_t *chunk = my_malloc_sized(chunk_size, &actual);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->next = r->chunks;
+  r->chunks = chunk;
+  char *p = (char *) (chunk + 1);
+  if (!own) {
+    r->cur = p + size;
+    r->end = (char *) chunk + actual;
+  }
+  return p;
+}
+
+/*
+Allocates size bytes from r, aligned to ALIGNMENT. The block cannot be
+freed on its own; it lives until r is reset or destroyed. A request of 0
+bytes gets ALIGNMENT bytes, so that it too returns a distinct pointer.
+
+Returns the pointer, or NULL if the heap cannot grow.
+*/
+void *region_alloc(region_t *r, size_t size) {
+  if (size == 0) {
+    size = ALIGNMENT;
+  }
+  size = (size + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+  if (size <= (size_t) (r->end - r->cur)) {
+    void *p = r->cur;
+    r->cur += size;
+    return p;
+  }
+  return region_grow(r, size);
+}
+
+/*
+Frees everything allocated from r and leaves r empty. The chunks are
+freed with my_free_batch, which merges the chunks that lie next to each
+other, so a region that grew through the top of the heap goes back to
+the bins as a single block.
+*/
+void region_reset(region_t *r) {
+  void *chunks[64];
+  region_chunk_t *chunk = r->chunks;
+  while (chunk != NULL) {
+    size_t n = 0;
+    for (; chunk != NULL && n < sizeof(chunks) / sizeof(chunks[0]); ++n) {
+      chunks[n] = chunk;
+      chunk = chunk->next;
+    }
+    my_free_batch(chunks, n);
+  }
+  r->cur = NULL;
+  r->end = NULL;
+  r->chunks = NULL;
+}
+
+//Resets r and frees it
+void region_destroy(region_t *r) {
+  region_reset(r);
+  my_free(r);
 }
 
+//----------End of regions
@@ -21,6 +21,8 @@
  **/
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #ifndef _ALLOCATOR_INTERFACE_H
@@ -33,8 +35,12 @@
 typedef struct {
   int (*init)(void);
   void* (*malloc)(size_t size);
+  void* (*memalign)(size_t alignment, size_t size);
+  void* (*malloc_sized)(size_t size, size_t* actual);
+  size_t (*usable_size)(void* ptr);
   void* (*realloc)(void* ptr, size_t size);
   void (*free)(void* ptr);
+  void (*free_sized)(void* ptr, size_t size);
   int (*check)();
   void (*reset_brk)(void);
   void* (*heap_lo)(void);
@@ -43,8 +49,12 @@ typedef struct {
 
 int libc_init();
 void* libc_malloc(size_t size);
+void* libc_memalign(size_t alignment, size_t size);
+void* libc_malloc_sized(size_t size, size_t* actual);
+size_t libc_usable_size(void* ptr);
 void* libc_realloc(void* ptr, size_t size);
 void libc_free(void* ptr);
+void libc_free_sized(void* ptr, size_t size);
 int libc_check();
 void libc_reset_brk();
 void* libc_heap_lo();
@@ -52,8 +62,12 @@ void* libc_heap_hi();
 
 static const malloc_impl_t libc_impl = {.init = &libc_init,
                                         .malloc = &libc_malloc,
+                                        .memalign = &libc_memalign,
+                                        .malloc_sized = &libc_malloc_sized,
+                                        .usable_size = &libc_usable_size,
                                         .realloc = &libc_realloc,
                                         .free = &libc_free,
+                                        .free_sized = &libc_free_sized,
                                         .check = &libc_check,
                                         .reset_brk = &libc_reset_brk,
                                         .heap_lo = &libc_heap_lo,
@@ -61,17 +75,74 @@ static const malloc_impl_t libc_impl = {.init = &libc_init,
 
 int my_init();
 void* my_malloc(size_t size);
+// Aligned allocation. alignment must be a power of two, and for
+// my_posix_memalign also a multiple of sizeof(void*).
+void* my_memalign(size_t alignment, size_t size);
+void* my_aligned_alloc(size_t alignment, size_t size);
+int my_posix_memalign(void** memptr, size_t alignment, size_t size);
+// The number of bytes the caller may use in a block, which is at least the
+// requested size. my_malloc_sized also stores it in *actual.
+size_t my_malloc_usable_size(void* ptr);
+void* my_malloc_sized(size_t size, size_t* actual);
+// Allocates n blocks of size bytes into out and returns how many it got.
+size_t my_malloc_batch(size_t size, size_t n, void** out);
+// Frees n blocks, which may be NULL. Overwrites ptrs.
+void my_free_batch(void** ptrs, size_t n);
 void* my_realloc(void* ptr, size_t size);
+void* my_calloc(size_t nmemb, size_t size);
 void my_free(void* ptr);
+// Frees a block allocated or last reallocated for size bytes.
+void my_free_sized(void* ptr, size_t size);
 int my_check();
+// Counters filled in by my_malloc_stats. Size class k holds the blocks of
+// more than 2^(k-1) and at most 2^k usable bytes; the last class also holds
+// all larger blocks.
+#define MALLOC_STATS_CLASSES 40
+typedef struct {
+  uint64_t mallocs[MALLOC_STATS_CLASSES];
+  uint64_t frees[MALLOC_STATS_CLASSES];
+  uint64_t splits[MALLOC_STATS_CLASSES];
+  uint64_t coalesces[MALLOC_STATS_CLASSES];
+  uint64_t free_bytes[MALLOC_STATS_CLASSES];
+  uint64_t sbrk_calls;
+  uint64_t sbrk_bytes;
+  uint64_t live_bytes;
+  uint64_t peak_live_bytes;
+} my_malloc_stats_t;
+// Fills stats and returns 0, or returns -1 if built without STATS.
+int my_malloc_stats(my_malloc_stats_t* stats);
+// Writes the sampled live blocks to out as a pprof heap profile and returns
+// 0, or returns -1 if built without PROFILE_SAMPLE_BYTES.
+int my_malloc_profile(FILE* out);
+// Gives free memory back to memlib, keeping pad bytes free at the top of the
+// heap. Returns 1 if any memory was given back, or else 0.
+int my_malloc_trim(size_t pad);
+// Starts and stops the thread that gives back the pages of blocks that stay
+// free, see SCAVENGE_DECAY_MS. Start returns 0, or -1 if built without it.
+int my_scavenger_start(void);
+void my_scavenger_stop(void);
 void my_reset_brk();
 void* my_heap_lo();
 void* my_heap_hi();
+// Regions hand out blocks with a bump pointer from chunks of the heap and
+// free all of them at once on region_reset or region_destroy.
+typedef struct region_t region_t;
+region_t* region_create(void);
+void* region_alloc(region_t* r, size_t size);
+void region_reset(region_t* r);
+void region_destroy(region_t* r);
+// The copy my_realloc moves blocks with. dst and src are 8-byte aligned, do
+// not overlap and size is a multiple of 8.
+void my_memcpy(void* dst, const void* src, size_t size);
 
 static const malloc_impl_t my_impl = {.init = &my_init,
                                       .malloc = &my_malloc,
+                                      .memalign = &my_memalign,
+                                      .malloc_sized = &my_malloc_sized,
+                                      .usable_size = &my_malloc_usable_size,
                                       .realloc = &my_realloc,
                                       .free = &my_free,
+                                      .free_sized = &my_free_sized,
                                       .check = &my_check,
                                       .reset_brk = &my_reset_brk,
                                       .heap_lo = &my_heap_lo,
@@ -79,8 +150,12 @@ static const malloc_impl_t my_impl = {.init = &my_init,
 
 int bad_init();
 void* bad_malloc(size_t size);
+void* bad_memalign(size_t alignment, size_t size);
+void* bad_malloc_sized(size_t size, size_t* actual);
+size_t bad_usable_size(void* ptr);
 void* bad_realloc(void* ptr, size_t size);
 void bad_free(void* ptr);
+void bad_free_sized(void* ptr, size_t size);
 int bad_check();
 void bad_reset_brk();
 void* bad_heap_lo();
@@ -88,8 +163,12 @@ void* bad_heap_hi();
 
 static const malloc_impl_t bad_impl = {.init = &bad_init,
                                        .malloc = &bad_malloc,
+                                       .memalign = &bad_memalign,
+                                       .malloc_sized = &bad_malloc_sized,
+                                       .usable_size = &bad_usable_size,
                                        .realloc = &bad_realloc,
                                        .free = &bad_free,
+                                       .free_sized = &bad_free_sized,
                                        .check = &bad_check,
                                        .reset_brk = &bad_reset_brk,
                                        .heap_lo = &bad_heap_lo,
@@ -20,19 +20,560 @@
  * IN THE SOFTWARE.
  **/
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "./allocator_interface.h"
+#include "./config.h"
 #include "./fasttime.h"
 #include "./memlib.h"
 
 #define NUM_ALLOCS 17
 #define NUM_ITERATIONS 1 << 17
 
+// Parameters of the multi-threaded benchmark (-t)
+#define THREAD_BATCH 64
+#define THREAD_ITERATIONS (1 << 14)
+#define THREAD_MAX_SIZE 256
+
+// Parameters of the producer/consumer benchmark (-p)
+#define PC_ITEMS (1 << 20)
+#define PC_RING_SIZE 1024
+#define PC_MAX_SIZE 1024
+
+// Parameters of the realloc benchmark (-r)
+#define GROW_ROUNDS 64
+#define GROW_STEPS 256
+#define GROW_MAX_STEP 64
+
+// Parameters of the copy benchmark (-c): bytes copied per size
+#define COPY_BYTES (1ul << 30)
+
+// Parameters of the batch benchmark (-b): blocks allocated per size
+#define BATCH_BLOCKS (1ul << 23)
+#define BATCH_NODE_SIZE 48
+
+// Parameters of the region benchmark (-g): objects allocated per size
+#define REGION_OBJECTS (1ul << 23)
+#define REGION_MAX_SIZE 256
+
+// Parameters of the heap profile demo (-h): blocks allocated at each site
+#define LEAK_BLOCKS (1 << 13)
+
+// Parameters of the scavenger demo (-s): blocks allocated per burst, their
+// size, and one in every BURST_KEEP of them stays allocated
+#define BURST_BLOCKS 1024
+#define BURST_BLOCK_SIZE (64 * 1024)
+#define BURST_KEEP 16
+// and the resident heap is sampled every half decay interval of the scavenger
+#ifdef SCAVENGE_DECAY_MS
+#define BURST_SAMPLE_MS (SCAVENGE_DECAY_MS / 2)
+#else
+#define BURST_SAMPLE_MS 0
+#endif
+
 const malloc_impl_t* mem_impl;
 int verbose = 0;
 
-int main() {
+// Each thread repeatedly allocates THREAD_BATCH small blocks of random
+// sizes and frees them again.
+static void* thread_churn(void* arg) {
+  unsigned int seed = (unsigned int)(uintptr_t)arg;
+  void* allocs[THREAD_BATCH];
+
+  for (int iter = 0; iter < THREAD_ITERATIONS; iter++) {
+    for (int i = 0; i < THREAD_BATCH; i++) {
+      allocs[i] = mem_impl->malloc(1 + rand_r(&seed) % THREAD_MAX_SIZE);
+    }
+    for (int i = 0; i < THREAD_BATCH; i++) {
+      mem_impl->free(allocs[i]);
+    }
+  }
+  return NULL;
+}
+
+// Runs thread_churn on num_threads threads and returns the elapsed seconds.
+static double run_threads(int num_threads) {
+  pthread_t threads[num_threads];
+
+  fasttime_t begin = gettime();
+  for (int i = 0; i < num_threads; i++) {
+    pthread_create(&threads[i], NULL, thread_churn, (void*)(uintptr_t)(i + 1));
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  fasttime_t end = gettime();
+  return tdiff(begin, end);
+}
+
+// Single-producer single-consumer ring of blocks between two threads.
+typedef struct {
+  void* slots[PC_RING_SIZE];
+  uint64_t head;  // next slot to pop, written by the consumer
+  uint64_t tail;  // next slot to push, written by the producer
+  unsigned int seed;
+} ring_t;
+
+// Allocates PC_ITEMS blocks of random sizes and hands them to the consumer.
+static void* producer(void* arg) {
+  ring_t* ring = arg;
+  for (int i = 0; i < PC_ITEMS; i++) {
+    char* p = mem_impl->malloc(1 + rand_r(&ring->seed) % PC_MAX_SIZE);
+    p[0] = (char)i;
+    uint64_t tail = ring->tail;
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == PC_RING_SIZE) {
+      sched_yield();
+    }
+    ring->slots[tail % PC_RING_SIZE] = p;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+// Frees the PC_ITEMS blocks the producer hands over.
+static void* consumer(void* arg) {
+  ring_t* ring = arg;
+  for (int i = 0; i < PC_ITEMS; i++) {
+    uint64_t head = ring->head;
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+      sched_yield();
+    }
+    mem_impl->free(ring->slots[head % PC_RING_SIZE]);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+// Runs num_pairs producer/consumer pairs and returns the elapsed seconds.
+static double run_pairs(int num_pairs) {
+  pthread_t threads[2 * num_pairs];
+  ring_t* rings = calloc(num_pairs, sizeof(ring_t));
+
+  fasttime_t begin = gettime();
+  for (int i = 0; i < num_pairs; i++) {
+    rings[i].seed = i + 1;
+    pthread_create(&threads[2 * i], NULL, producer, &rings[i]);
+    pthread_create(&threads[2 * i + 1], NULL, consumer, &rings[i]);
+  }
+  for (int i = 0; i < 2 * num_pairs; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  fasttime_t end = gettime();
+  free(rings);
+  return tdiff(begin, end);
+}
+
+// Compares the throughput of libc and our allocator when every block is
+// freed by a different thread than the one that allocated it, for 1, 2,
+// 4, ... max_pairs producer/consumer pairs.
+static int producer_consumer_benchmark(int max_pairs) {
+  if (!THREADS) {
+    fprintf(stderr, "Rebuild with PARAMS=\"-D THREADS=1\" to run -p\n");
+    return 1;
+  }
+
+  mem_init();
+  my_impl.init();
+
+  printf("%8s%16s%16s\n", "pairs", "libc Mops/s", "my Mops/s");
+  for (int n = 1; n <= max_pairs; n *= 2) {
+    double ops = 2.0 * n * PC_ITEMS;
+    mem_impl = &libc_impl;
+    double libc_secs = run_pairs(n);
+    mem_impl = &my_impl;
+    double my_secs = run_pairs(n);
+    printf("%8d%16.2f%16.2f\n", n, ops / libc_secs / 1e6, ops / my_secs / 1e6);
+  }
+
+  mem_deinit();
+  return 0;
+}
+
+// Grows num_vectors blocks in round robin by GROW_STEPS small increments
+// each, like vectors appended to in an interleaved fashion, and frees them.
+// Returns the elapsed seconds and stores in *moves how many calls to
+// realloc returned a different address.
+static double run_vectors(int num_vectors, uint64_t* moves) {
+  char* vectors[num_vectors];
+  size_t sizes[num_vectors];
+  unsigned int seed = 1;
+  *moves = 0;
+
+  fasttime_t begin = gettime();
+  for (int round = 0; round < GROW_ROUNDS; round++) {
+    for (int i = 0; i < num_vectors; i++) {
+      sizes[i] = 1 + rand_r(&seed) % GROW_MAX_STEP;
+      vectors[i] = mem_impl->malloc(sizes[i]);
+    }
+    for (int step = 0; step < GROW_STEPS; step++) {
+      for (int i = 0; i < num_vectors; i++) {
+        sizes[i] += 1 + rand_r(&seed) % GROW_MAX_STEP;
+        char* p = mem_impl->realloc(vectors[i], sizes[i]);
+        p[sizes[i] - 1] = (char)step;
+        *moves += (p != vectors[i]);
+        vectors[i] = p;
+      }
+    }
+    for (int i = 0; i < num_vectors; i++) {
+      mem_impl->free(vectors[i]);
+    }
+  }
+  fasttime_t end = gettime();
+  return tdiff(begin, end);
+}
+
+// Compares how often libc and our allocator move a growing block, and how
+// long they take, for 1, 2, 4, ... max_vectors blocks growing at once.
+static int realloc_benchmark(int max_vectors) {
+  mem_init();
+  my_impl.init();
+
+  printf("%8s%12s%12s%12s%12s\n", "vectors", "libc moves", "libc secs",
+         "my moves", "my secs");
+  for (int n = 1; n <= max_vectors; n *= 2) {
+    uint64_t libc_moves, my_moves;
+    mem_impl = &libc_impl;
+    double libc_secs = run_vectors(n, &libc_moves);
+    mem_impl = &my_impl;
+    double my_secs = run_vectors(n, &my_moves);
+    printf("%8d%12lu%12.3f%12lu%12.3f\n", n, libc_moves, libc_secs, my_moves,
+           my_secs);
+  }
+
+  mem_deinit();
+  return 0;
+}
+
+// Copies size bytes between two 8-byte aligned buffers until COPY_BYTES
+// bytes are copied, and returns the elapsed seconds.
+static double run_copies(void (*copy)(void*, const void*, size_t),
+                         char* dst, const char* src, size_t size) {
+  fasttime_t begin = gettime();
+  for (size_t done = 0; done < COPY_BYTES; done += size) {
+    copy(dst, src, size);
+  }
+  fasttime_t end = gettime();
+  return tdiff(begin, end);
+}
+
+static void libc_memcpy(void* dst, const void* src, size_t size) {
+  memcpy(dst, src, size);
+}
+
+// Compares the throughput of memcpy and the copy that my_realloc moves
+// blocks with, for blocks of 8, 32, 128, ... max_size bytes.
+static int copy_benchmark(size_t max_size) {
+  mem_init();
+  my_impl.init();
+
+  // offset by a word, like the blocks of the allocator
+  char* src = malloc(max_size + 8) + 8;
+  char* dst = malloc(max_size + 8) + 8;
+  memset(src, 1, max_size);
+  memset(dst, 2, max_size);
+
+  printf("%12s%16s%16s\n", "size", "memcpy GB/s", "my GB/s");
+  for (size_t size = 8; size <= max_size; size *= 4) {
+    double libc_secs = run_copies(libc_memcpy, dst, src, size);
+    double my_secs = run_copies(my_memcpy, dst, src, size);
+    printf("%12zu%16.2f%16.2f\n", size, COPY_BYTES / libc_secs / 1e9,
+           COPY_BYTES / my_secs / 1e9);
+  }
+
+  free(src - 8);
+  free(dst - 8);
+  mem_deinit();
+  return 0;
+}
+
+// Builds and tears down graphs of n nodes of BATCH_NODE_SIZE bytes until
+// BATCH_BLOCKS nodes were allocated, with single calls or with batch calls
+// when batch is set. Nodes are freed in random order. Returns the elapsed
+// seconds.
+static double run_batches(size_t n, int batch) {
+  void** nodes = malloc(n * sizeof(void*));
+  unsigned int seed = 1;
+
+  fasttime_t begin = gettime();
+  for (size_t done = 0; done < BATCH_BLOCKS; done += n) {
+    if (batch) {
+      if (my_malloc_batch(BATCH_NODE_SIZE, n, nodes) != n) {
+        fprintf(stderr, "my_malloc_batch failed\n");
+        exit(1);
+      }
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        nodes[i] = my_malloc(BATCH_NODE_SIZE);
+      }
+    }
+    for (size_t i = n - 1; i > 0; i--) {
+      size_t j = rand_r(&seed) % (i + 1);
+      void* node = nodes[i];
+      nodes[i] = nodes[j];
+      nodes[j] = node;
+    }
+    if (batch) {
+      my_free_batch(nodes, n);
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        my_free(nodes[i]);
+      }
+    }
+  }
+  fasttime_t end = gettime();
+
+  free(nodes);
+  return tdiff(begin, end);
+}
+
+// Compares looping over my_malloc and my_free with my_malloc_batch and
+// my_free_batch, for graphs of 16, 64, 256, ... max_nodes nodes.
+static int batch_benchmark(size_t max_nodes) {
+  mem_init();
+  my_impl.init();
+
+  printf("%10s%16s%16s\n", "nodes", "loop Mops/s", "batch Mops/s");
+  for (size_t n = 16; n <= max_nodes; n *= 4) {
+    double ops = 2.0 * (BATCH_BLOCKS / n) * n;
+    double loop_secs = run_batches(n, 0);
+    double batch_secs = run_batches(n, 1);
+    printf("%10zu%16.2f%16.2f\n", n, ops / loop_secs / 1e6,
+           ops / batch_secs / 1e6);
+  }
+
+  mem_deinit();
+  return 0;
+}
+
+// Serves requests that each allocate n objects of up to REGION_MAX_SIZE
+// bytes and free them together when they are done, until REGION_OBJECTS
+// objects were allocated. Objects come from mem_impl, or from a region that
+// is reset after every request when region is set. Returns the elapsed
+// seconds.
+static double run_requests(size_t n, int region) {
+  void** objects = malloc(n * sizeof(void*));
+  region_t* r = region ? region_create() : NULL;
+  unsigned int seed = 1;
+
+  fasttime_t begin = gettime();
+  for (size_t done = 0; done < REGION_OBJECTS; done += n) {
+    for (size_t i = 0; i < n; i++) {
+      size_t size = 1 + rand_r(&seed) % REGION_MAX_SIZE;
+      char* object = region ? region_alloc(r, size) : mem_impl->malloc(size);
+      object[0] = object[size - 1] = (char)i;
+      objects[i] = object;
+    }
+    if (region) {
+      region_reset(r);
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        mem_impl->free(objects[i]);
+      }
+    }
+  }
+  fasttime_t end = gettime();
+
+  if (region) {
+    region_destroy(r);
+  }
+  free(objects);
+  return tdiff(begin, end);
+}
+
+// Compares freeing the objects of a request one by one, with libc and our
+// allocator, with resetting a region, for requests of 16, 64, 256, ...
+// max_objects objects.
+static int region_benchmark(size_t max_objects) {
+  mem_init();
+  my_impl.init();
+
+  printf("%10s%16s%16s%16s\n", "objects", "libc Mops/s", "my Mops/s",
+         "region Mops/s");
+  for (size_t n = 16; n <= max_objects; n *= 4) {
+    double ops = 2.0 * (REGION_OBJECTS / n) * n;
+    mem_impl = &libc_impl;
+    double libc_secs = run_requests(n, 0);
+    mem_impl = &my_impl;
+    double my_secs = run_requests(n, 0);
+    double region_secs = run_requests(n, 1);
+    printf("%10zu%16.2f%16.2f%16.2f\n", n, ops / libc_secs / 1e6,
+           ops / my_secs / 1e6, ops / region_secs / 1e6);
+  }
+
+  mem_deinit();
+  return 0;
+}
+
+// Allocates LEAK_BLOCKS blocks of size bytes and frees all but one in every
+// keep_every of them into kept. Each caller is its own allocation site in
+// the heap profile.
+static size_t leak(void** kept, size_t size, int keep_every) {
+  size_t n = 0;
+  for (int i = 0; i < LEAK_BLOCKS; i++) {
+    void* p = mem_impl->malloc(size);
+    if (i % keep_every == 0) {
+      kept[n++] = p;
+    } else {
+      mem_impl->free(p);
+    }
+  }
+  return n;
+}
+
+__attribute__((noinline)) static size_t leak_small(void** kept) {
+  return leak(kept, 64, 4);
+}
+
+__attribute__((noinline)) static size_t leak_large(void** kept) {
+  return leak(kept, 4096, 2);
+}
+
+// Allocates from two sites that keep some of their blocks, and writes the
+// heap profile of what is still allocated to path.
+static int profile_demo(const char* path) {
+  mem_init();
+  mem_impl = &my_impl;
+  mem_impl->init();
+
+  void** kept = malloc(2 * LEAK_BLOCKS * sizeof(void*));
+  size_t n = leak_small(kept);
+  n += leak_large(kept + n);
+
+  FILE* out = fopen(path, "w");
+  if (out == NULL) {
+    perror(path);
+    return 1;
+  }
+  int result = my_malloc_profile(out);
+  fclose(out);
+  if (result != 0) {
+    fprintf(stderr,
+            "Rebuild with PARAMS=\"-D PROFILE_SAMPLE_BYTES=524288\" to run "
+            "-h\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    mem_impl->free(kept[i]);
+  }
+  free(kept);
+  mem_deinit();
+  return 0;
+}
+
+// Milliseconds since the first call
+static double elapsed_ms(void) {
+  static fasttime_t start;
+  static int started = 0;
+  if (!started) {
+    start = gettime();
+    started = 1;
+  }
+  return tdiff(start, gettime()) * 1e3;
+}
+
+// Allocates and touches bursts of blocks, of which the scavenger should give
+// back the pages once they stay free, and prints the resident heap over
+// about three decay intervals after each of rounds bursts.
+static int scavenger_demo(int rounds) {
+  mem_init();
+  mem_impl = &my_impl;
+  mem_impl->init();
+  if (my_scavenger_start() != 0) {
+    fprintf(stderr,
+            "Rebuild with PARAMS=\"-D THREADS=1 -D MEM_MMAP=1 "
+            "-D SCAVENGE_DECAY_MS=200\" to run -s\n");
+    return 1;
+  }
+
+  void* burst[BURST_BLOCKS];
+  size_t live = 0;
+  printf("%10s%12s%12s%14s\n", "ms", "live KB", "heap KB", "resident KB");
+  for (int round = 0; round < rounds; round++) {
+    for (int i = 0; i < BURST_BLOCKS; i++) {
+      burst[i] = mem_impl->malloc(BURST_BLOCK_SIZE);
+      memset(burst[i], i, BURST_BLOCK_SIZE);
+    }
+    live += BURST_BLOCKS * BURST_BLOCK_SIZE;
+    //the blocks that stay keep the heap from being trimmed
+    for (int i = 0; i < BURST_BLOCKS; i++) {
+      if (i % BURST_KEEP != BURST_KEEP - 1) {
+        mem_impl->free(burst[i]);
+        live -= BURST_BLOCK_SIZE;
+      }
+    }
+    for (int tick = 0; tick <= 6; tick++) {
+      printf("%10.0f%12zu%12zu%14zu\n", elapsed_ms(), live >> 10,
+             mem_heapsize() >> 10, mem_resident() >> 10);
+      usleep(BURST_SAMPLE_MS * 1000);
+    }
+  }
+
+  my_scavenger_stop();
+  mem_deinit();
+  return 0;
+}
+
+// Compares the throughput of libc and our allocator for 1, 2, 4, ...
+// max_threads threads.
+static int thread_benchmark(int max_threads) {
+  if (!THREADS) {
+    fprintf(stderr, "Rebuild with PARAMS=\"-D THREADS=1\" to run -t\n");
+    return 1;
+  }
+
+  mem_init();
+  my_impl.init();
+
+  printf("%8s%16s%16s\n", "threads", "libc Mops/s", "my Mops/s");
+  for (int n = 1; n <= max_threads; n *= 2) {
+    double ops = 2.0 * n * THREAD_ITERATIONS * THREAD_BATCH;
+    mem_impl = &libc_impl;
+    double libc_secs = run_threads(n);
+    mem_impl = &my_impl;
+    double my_secs = run_threads(n);
+    printf("%8d%16.2f%16.2f\n", n, ops / libc_secs / 1e6, ops / my_secs / 1e6);
+  }
+
+  mem_deinit();
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "t:p:r:c:b:g:h:s:")) != -1) {
+    switch (c) {
+      case 't':
+        return thread_benchmark(atoi(optarg));
+      case 'p':
+        return producer_consumer_benchmark(atoi(optarg));
+      case 'r':
+        return realloc_benchmark(atoi(optarg));
+      case 'c':
+        return copy_benchmark(strtoul(optarg, NULL, 0));
+      case 'b':
+        return batch_benchmark(strtoul(optarg, NULL, 0));
+      case 'g':
+        return region_benchmark(strtoul(optarg, NULL, 0));
+      case 'h':
+        return profile_demo(optarg);
+      case 's':
+        return scavenger_demo(atoi(optarg));
+      default:
+        fprintf(stderr,
+                "Usage: allocator_test [-t <max threads>] [-p <max pairs>] "
+                "[-r <max vectors>] [-c <max bytes>] [-b <max nodes>] "
+                "[-g <max objects>] [-h <profile file>] [-s <rounds>]\n");
+        return 1;
+    }
+  }
+
   mem_init();
 
   mem_impl = &my_impl;
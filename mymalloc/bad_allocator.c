@@ -52,11 +52,28 @@ void* bad_malloc(size_t size) {
   }
 }
 
+// bad_memalign - Ignores the alignment, so the block is usually misaligned.
+void* bad_memalign(size_t alignment, size_t size) { return bad_malloc(size); }
+
+// bad_malloc_sized - Claims the requested size, which may not fit.
+void* bad_malloc_sized(size_t size, size_t* actual) {
+  *actual = size;
+  return bad_malloc(size);
+}
+
+// bad_usable_size - Claims more than any block holds.
+size_t bad_usable_size(void* ptr) { return 2 * BAD_SIZE; }
+
 // bad_free - Freeing a block does nothing.
 void bad_free(void* ptr) {
   // Do nothing.
 }
 
+// bad_free_sized - Freeing a block does nothing.
+void bad_free_sized(void* ptr, size_t size) {
+  // Do nothing.
+}
+
 // bad_realloc - Implemented simply in terms of bad_malloc and bad_free, but
 // lacks copy step.
 void* bad_realloc(void* ptr, size_t size) {
@@ -37,6 +37,38 @@
 
 #define MEM_ALLOWANCE (40 * (1 << 10)) /* 40 KB */
 
+/*
+ * Set MEM_MMAP to 1 (e.g. make PARAMS="-D MEM_MMAP=1") to back the heap with
+ * MEM_RESERVE bytes of address space that memlib reserves with mmap and
+ * commits as the heap grows, instead of the MAX_HEAP bytes that it allocates
+ * and clears up front. mdriver is graded with the simulated heap.
+ */
+#ifndef MEM_MMAP
+#define MEM_MMAP 0
+#endif
+
+#ifndef MEM_RESERVE
+#define MEM_RESERVE (1ul << 32) /* 4 GB */
+#endif
+
+/*
+ * Largest heap that mem_sbrk can hand out
+ */
+#if MEM_MMAP
+#define MEM_LIMIT MEM_RESERVE
+#else
+#define MEM_LIMIT MAX_HEAP
+#endif
+
+/*
+ * Set THREADS to 1 (e.g. make PARAMS="-D THREADS=1") to build an allocator
+ * that may be called from several threads at once. The default build is
+ * serial, which is what mdriver measures.
+ */
+#ifndef THREADS
+#define THREADS 0
+#endif
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -20,6 +20,8 @@
  * IN THE SOFTWARE.
  **/
 
+#include <malloc.h>
+
 #include "./allocator_interface.h"
 
 /* Libc needs no initialization. */
@@ -41,8 +43,29 @@ void* libc_heap_hi() { return NULL; }
 /*call default malloc */
 void* libc_malloc(size_t size) { return malloc(size); }
 
+/*call default posix_memalign */
+void* libc_memalign(size_t alignment, size_t size) {
+  void* p;
+  return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+
+/*call default malloc and malloc_usable_size */
+void* libc_malloc_sized(size_t size, size_t* actual) {
+  void* p = malloc(size);
+  if (p != NULL) {
+    *actual = malloc_usable_size(p);
+  }
+  return p;
+}
+
+/*call default malloc_usable_size */
+size_t libc_usable_size(void* ptr) { return malloc_usable_size(ptr); }
+
 /*call default realloc */
 void* libc_realloc(void* ptr, size_t size) { return realloc(ptr, size); }
 
 /*call default realloc */
 void libc_free(void* ptr) { free(ptr); }
+
+/*call default free, which has no use for the size */
+void libc_free_sized(void* ptr, size_t size) { free(ptr); }
@@ -65,9 +65,12 @@ static void eval_libc_speed(trace_t* trace) {
 }
 static int eval_mm_check(const malloc_impl_t* impl, trace_t* trace,
                          int tracenum);
+static void eval_mm_rss(const malloc_impl_t* impl, trace_t* trace,
+                        char* tracefile);
 
 /* Various helper routines */
 static void printresults(int n, char** tracefiles, stats_t* stats);
+static void print_malloc_stats(char* tracefile);
 static void usage(void);
 
 /**************
@@ -89,6 +92,8 @@ int main(int argc, char** argv) {
   int run_bad = 0;    /* If set, run bad malloc (set by -b) */
   int check_heap = 0; /* If set, run the student heap checker (set by -c) */
   int autograder = 0; /* If set, emit summary info for autograder (-g) */
+  int print_stats = 0; /* If set, print my_malloc_stats per trace (-s) */
+  int print_rss = 0;   /* If set, print the RSS over each trace (-m) */
 
   /* temporaries used to compute the performance index */
   double total_log_throughput, total_log_util, average_log_util,
@@ -98,7 +103,7 @@ int main(int argc, char** argv) {
   /*
    * Read and interpret the command line arguments
    */
-  while ((c = getopt(argc, argv, "f:t:hvVgcb")) != EOF) {
+  while ((c = getopt(argc, argv, "f:t:hvVgcbsm")) != EOF) {
     switch (c) {
       case 'g': /* Generate summary info for the autograder */
         autograder = 1;
@@ -130,6 +135,12 @@ int main(int argc, char** argv) {
       case 'c':
         check_heap = 1;
         break;
+      case 's': /* Print the allocator's counters after each trace */
+        print_stats = 1;
+        break;
+      case 'm': /* Print the resident memory over each trace */
+        print_rss = 1;
+        break;
       case 'v': /* Print per-trace performance breakdown */
         verbose = 1;
         break;
@@ -270,6 +281,14 @@ int main(int argc, char** argv) {
     unix_error("mm_stats calloc in main failed");
   }
 
+  if (print_stats) {
+    my_malloc_stats_t counters;
+    if (my_malloc_stats(&counters) < 0) {
+      fprintf(stderr, "Rebuild with PARAMS=\"-D STATS=1\" to use -s\n");
+      exit(1);
+    }
+  }
+
   /* Evaluate student's mm malloc package using the K-best scheme */
   for (i = 0; i < num_tracefiles; i++) {
     trace = read_trace(tracedir, tracefiles[i]);
@@ -286,6 +305,12 @@ int main(int argc, char** argv) {
         printf("efficiency, ");
       }
       mm_stats[i].util = eval_mm_util(&my_impl, trace);
+      if (print_stats) {
+        print_malloc_stats(tracefiles[i]);
+      }
+      if (print_rss) {
+        eval_mm_rss(&my_impl, trace, tracefiles[i]);
+      }
       if (verbose > 1) {
         printf("and performance.\n");
       }
@@ -294,6 +319,11 @@ int main(int argc, char** argv) {
     free_trace(trace);
   }
 
+  if (verbose) {
+    printf("\nmemlib: %zu bytes committed of %zu reserved\n", mem_committed(),
+           mem_reserved());
+  }
+
   /* Free the simulated heap block. */
   mem_deinit();
 
@@ -378,7 +408,7 @@ int main(int argc, char** argv) {
   printf("runtime:%f\n", tdiff(begin, end));
 #endif
 
-  exit(0);
+  exit(errors == 0 ? 0 : 1);
 }
 
 /**********************************************
@@ -393,7 +423,7 @@ static trace_t* read_trace(char* tracedir, char* filename) {
   trace_t* trace;
   char type[MAXLINE];
   char path[MAXLINE];
-  unsigned index, size;
+  unsigned index, size, alignment;
   unsigned max_index = 0;
   unsigned op_index;
 
@@ -447,6 +477,14 @@ static trace_t* read_trace(char* tracedir, char* filename) {
         trace->ops[op_index].size = size;
         max_index = (index > max_index) ? index : max_index;
         break;
+      case 'm':
+        fscanf(tracefile, "%u %u %u", &index, &alignment, &size);
+        trace->ops[op_index].type = ALIGNED_ALLOC;
+        trace->ops[op_index].index = index;
+        trace->ops[op_index].alignment = alignment;
+        trace->ops[op_index].size = size;
+        max_index = (index > max_index) ? index : max_index;
+        break;
       case 'r':
         fscanf(tracefile, "%u %u", &index, &size);
         trace->ops[op_index].type = REALLOC;
@@ -499,8 +537,8 @@ void free_trace(trace_t* trace) {
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace.
+ *   largest size of the heap in bytes while running the student's
+ *   malloc package on the trace, which may trim the heap.
  *
  */
 static double eval_mm_util(const malloc_impl_t* impl, trace_t* trace) {
@@ -521,11 +559,17 @@ static double eval_mm_util(const malloc_impl_t* impl, trace_t* trace) {
 
   for (i = 0; i < trace->num_ops; i++) {
     switch (trace->ops[i].type) {
-      case ALLOC: /* alloc */
+      case ALLOC:         /* alloc */
+      case ALIGNED_ALLOC: /* aligned alloc */
         index = trace->ops[i].index;
         size = trace->ops[i].size;
 
-        if ((p = (char*)impl->malloc(size)) == NULL) {
+        if (trace->ops[i].type == ALLOC) {
+          p = (char*)impl->malloc(size);
+        } else {
+          p = (char*)impl->memalign(trace->ops[i].alignment, size);
+        }
+        if (p == NULL) {
           app_error("malloc failed in eval_mm_util");
         }
 
@@ -587,7 +631,7 @@ static double eval_mm_util(const malloc_impl_t* impl, trace_t* trace) {
   }
   max_total_size =
       (max_total_size > MEM_ALLOWANCE) ? max_total_size : MEM_ALLOWANCE;
-  heap_size = mem_heapsize();
+  heap_size = mem_peak_heapsize();
   heap_size = (heap_size > MEM_ALLOWANCE) ? heap_size : MEM_ALLOWANCE;
   return ((double)max_total_size / (double)heap_size);
 }
@@ -622,6 +666,16 @@ static void eval_mm_speed(const malloc_impl_t* impl, trace_t* trace) {
         trace->blocks[index] = p;
         break;
 
+      case ALIGNED_ALLOC: /* memalign */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = (char*)impl->memalign(trace->ops[i].alignment, size)) ==
+            NULL) {
+          app_error("memalign error in eval_mm_speed");
+        }
+        trace->blocks[index] = p;
+        break;
+
       case REALLOC: /* realloc */
         index = trace->ops[i].index;
         newsize = trace->ops[i].size;
@@ -683,6 +737,17 @@ static int eval_mm_check(const malloc_impl_t* impl, trace_t* trace,
         trace->blocks[index] = p;
         break;
 
+      case ALIGNED_ALLOC: /* memalign */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = (char*)impl->memalign(trace->ops[i].alignment, size)) ==
+            NULL) {
+          malloc_error(tracenum, i, "impl memalign failed.");
+          return 0;
+        }
+        trace->blocks[index] = p;
+        break;
+
       case REALLOC: /* realloc */
         index = trace->ops[i].index;
         newsize = trace->ops[i].size;
@@ -762,6 +827,127 @@ static void printresults(int n, char** tracefiles, stats_t* stats) {
   }
 }
 
+/*
+ * rss_bytes - returns the resident set size of the process in bytes
+ */
+static size_t rss_bytes(void) {
+  unsigned long size, resident;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f == NULL) {
+    return 0;
+  }
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(f);
+  return resident * mem_pagesize();
+}
+
+/*
+ * eval_mm_rss - replays the trace on a heap whose memory went back to the
+ *   system, writing every block it allocates, and prints the heap size and
+ *   the resident set size of the process at every tenth of the trace and
+ *   after my_malloc_trim. Only the mmap backend of memlib (MEM_MMAP) gives
+ *   memory back, so RSS never drops with the simulated heap.
+ */
+static void eval_mm_rss(const malloc_impl_t* impl, trace_t* trace,
+                        char* tracefile) {
+  int i, index, size;
+  char* p;
+
+  mem_reset_brk();
+  mem_trim(0);
+  if (impl->init() < 0) {
+    app_error("init failed in eval_mm_rss");
+  }
+
+  printf("\nResident memory for %s:\n", tracefile);
+  printf("%12s%12s%12s\n", "ops", "heap KB", "rss KB");
+  printf("%12d%12zu%12zu\n", 0, mem_heapsize() / 1024, rss_bytes() / 1024);
+  for (i = 0; i < trace->num_ops; i++) {
+    switch (trace->ops[i].type) {
+      case ALLOC:
+      case ALIGNED_ALLOC:
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if (trace->ops[i].type == ALLOC) {
+          p = (char*)impl->malloc(size);
+        } else {
+          p = (char*)impl->memalign(trace->ops[i].alignment, size);
+        }
+        if (p == NULL) {
+          app_error("malloc failed in eval_mm_rss");
+        }
+        memset(p, 0, size);
+        trace->blocks[index] = p;
+        break;
+
+      case REALLOC:
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = (char*)impl->realloc(trace->blocks[index], size)) == NULL) {
+          app_error("realloc failed in eval_mm_rss");
+        }
+        memset(p, 0, size);
+        trace->blocks[index] = p;
+        break;
+
+      case FREE:
+        impl->free(trace->blocks[trace->ops[i].index]);
+        break;
+
+      case WRITE:
+        break;
+
+      default:
+        app_error("Nonexistent request type in eval_mm_rss");
+    }
+    if ((i + 1) * 10LL / trace->num_ops != i * 10LL / trace->num_ops) {
+      printf("%12d%12zu%12zu\n", i + 1, mem_heapsize() / 1024,
+             rss_bytes() / 1024);
+    }
+  }
+  my_malloc_trim(0);
+  printf("%12s%12zu%12zu\n", "trimmed", mem_heapsize() / 1024,
+         rss_bytes() / 1024);
+}
+
+/*
+ * print_malloc_stats - prints the counters of my_malloc_stats for the
+ *   run of the trace that measured utilization, one line per size class
+ *   that saw any activity. my_init zeroes the counters, so this must be
+ *   called after eval_mm_util and before any other run of the trace.
+ */
+static void print_malloc_stats(char* tracefile) {
+  my_malloc_stats_t counters;
+  if (my_malloc_stats(&counters) < 0) {
+    printf("\nNo allocator stats for %s\n", tracefile);
+    return;
+  }
+
+  printf("\nAllocator stats for %s:\n", tracefile);
+  printf("%12s%10s%10s%10s%10s%12s\n", "class", "mallocs", "frees", "splits",
+         "coalesces", "free bytes");
+  for (int k = 0; k < MALLOC_STATS_CLASSES; k++) {
+    if (counters.mallocs[k] == 0 && counters.frees[k] == 0 &&
+        counters.splits[k] == 0 && counters.coalesces[k] == 0 &&
+        counters.free_bytes[k] == 0) {
+      continue;
+    }
+    printf("%12llu%10llu%10llu%10llu%10llu%12llu\n", 1ull << k,
+           (unsigned long long)counters.mallocs[k],
+           (unsigned long long)counters.frees[k],
+           (unsigned long long)counters.splits[k],
+           (unsigned long long)counters.coalesces[k],
+           (unsigned long long)counters.free_bytes[k]);
+  }
+  printf("sbrk: %llu calls, %llu bytes; live: %llu bytes, peak %llu bytes\n",
+         (unsigned long long)counters.sbrk_calls,
+         (unsigned long long)counters.sbrk_bytes,
+         (unsigned long long)counters.live_bytes,
+         (unsigned long long)counters.peak_live_bytes);
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -790,7 +976,7 @@ void malloc_error(int tracenum, int opnum, char* msg) {
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-  fprintf(stderr, "Usage: mdriver [-hvVgc] [-f <file>] [-t <dir>]\n");
+  fprintf(stderr, "Usage: mdriver [-hvVgcsm] [-f <file>] [-t <dir>]\n");
   fprintf(stderr, "Options\n");
   fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
   fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
@@ -798,5 +984,7 @@ static void usage(void) {
   fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
   fprintf(stderr, "\t-V         Print additional debug info.\n");
   fprintf(stderr, "\t-c         Check the heap after every operation.\n");
+  fprintf(stderr, "\t-s         Print allocator stats after each trace.\n");
+  fprintf(stderr, "\t-m         Print the resident memory over each trace.\n");
   fprintf(stderr, "\t-h         Print this message.\n");
 }
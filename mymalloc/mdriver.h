@@ -48,7 +48,7 @@
 #define LINENUM(i) (i + 5) /* cnvt trace request nums to linenums (origin 1) \
                             */
 
-typedef enum { ALLOC, FREE, REALLOC, WRITE } traceop_type; /* type of request */
+typedef enum { ALLOC, ALIGNED_ALLOC, FREE, REALLOC, WRITE } traceop_type; /* type of request */
 /******************************
  * The key compound data types
  *****************************/
@@ -58,6 +58,7 @@ typedef struct {
   traceop_type type; /* type of request */
   int index;         /* index for free() to use later */
   int size;          /* byte size of alloc/realloc request */
+  int alignment;     /* alignment of aligned alloc request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -24,6 +24,10 @@
  * memlib.c - a module that simulates the memory system.  Needed because it
  *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ *            With MEM_MMAP, the heap is a range of address space reserved
+ *            with mmap instead, whose pages are committed with mprotect as
+ *            mem_sbrk hands them out.
  */
 #include <assert.h>
 #include <errno.h>
@@ -40,11 +44,34 @@
 static char* mem_start_brk; /* points to first byte of heap */
 static char* mem_brk;       /* points to last byte of heap */
 static char* mem_max_addr;  /* largest legal heap address */
+static char* mem_fresh;     /* first byte never handed out by mem_sbrk */
+static char* mem_peak_brk;  /* highest mem_brk since the last reset */
+#if MEM_MMAP
+static char* mem_commit;    /* first byte of the heap that is not committed */
+
+/* mem_sbrk commits memory in steps of at least this many bytes */
+#define MEM_COMMIT_SIZE (64 * (1 << 10))
+#endif
 
 /*
  * mem_init - initialize the memory system model
  */
 void mem_init(void) {
+#if MEM_MMAP
+  /* reserve the address space; no memory backs it until it is committed */
+  mem_start_brk = (char*)mmap(NULL, MEM_RESERVE, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem_start_brk == MAP_FAILED) {
+    fprintf(stderr, "mem_init_vm: mmap error\n");
+    exit(1);
+  }
+
+  mem_max_addr = mem_start_brk + MEM_RESERVE; /* max legal heap address */
+  mem_brk = mem_start_brk;                    /* heap is empty initially */
+  mem_fresh = mem_start_brk;
+  mem_peak_brk = mem_start_brk;
+  mem_commit = mem_start_brk;
+#else
   /* allocate the storage we will use to model the available VM */
   if ((mem_start_brk = (char*)malloc(MAX_HEAP)) == NULL) {
     fprintf(stderr, "mem_init_vm: malloc error\n");
@@ -53,38 +80,126 @@ void mem_init(void) {
 
   mem_max_addr = mem_start_brk + MAX_HEAP; /* max legal heap address */
   mem_brk = mem_start_brk;                 /* heap is empty initially */
+  mem_fresh = mem_start_brk;
+  mem_peak_brk = mem_start_brk;
 
   memset(mem_start_brk, 0,
          MAX_HEAP); /* Zero out memory to prevent page faults */
+#endif
 }
 
 /*
  * mem_deinit - free the storage used by the memory system model
  */
-void mem_deinit(void) { free(mem_start_brk); }
+void mem_deinit(void) {
+#if MEM_MMAP
+  munmap(mem_start_brk, MEM_RESERVE);
+#else
+  free(mem_start_brk);
+#endif
+}
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
-void mem_reset_brk(void) { mem_brk = mem_start_brk; }
+void mem_reset_brk(void) {
+  mem_brk = mem_start_brk;
+  mem_peak_brk = mem_start_brk;
+}
 
 /*
  * mem_sbrk - simple model of the sbrk function. Extends the heap
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. The
+ *    heap shrinks with mem_trim.
  */
-void* mem_sbrk(unsigned int incr) {
-  if ((mem_brk + incr) > mem_max_addr) {
+void* mem_sbrk(size_t incr) {
+  if (incr > (size_t)(mem_max_addr - mem_brk)) {
     errno = ENOMEM;
     fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory... (%ld)\n",
             mem_heapsize());
     return (void*)-1;
   }
+#if MEM_MMAP
+  /* commit the pages the new break reaches; fresh pages read as zero */
+  if (incr > (size_t)(mem_commit - mem_brk)) {
+    size_t commit = mem_brk + incr - mem_commit;
+    commit = commit < MEM_COMMIT_SIZE ? MEM_COMMIT_SIZE : commit;
+    commit = (commit + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if (commit > (size_t)(mem_max_addr - mem_commit)) {
+      commit = mem_max_addr - mem_commit;
+    }
+    if (mprotect(mem_commit, commit, PROT_READ | PROT_WRITE) != 0) {
+      fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory... (%ld)\n",
+              mem_heapsize());
+      errno = ENOMEM;
+      return (void*)-1;
+    }
+    mem_commit += commit;
+  }
+#endif
   char* old_brk = mem_brk;
   mem_brk += incr;
+  if (mem_brk > mem_fresh) {
+    mem_fresh = mem_brk;
+  }
+  if (mem_brk > mem_peak_brk) {
+    mem_peak_brk = mem_brk;
+  }
   return (void*)old_brk;
 }
 
+/*
+ * mem_release - gives the whole pages in [start, start + size) back to the
+ *    system, which reads them as zero the next time they are touched.
+ *    Returns the number of bytes released. The simulated heap keeps its
+ *    memory and releases nothing.
+ */
+size_t mem_release(void* start, size_t size) {
+#if MEM_MMAP
+  size_t page = mem_pagesize();
+  char* lo = (char*)(((size_t)start + page - 1) & ~(page - 1));
+  char* hi = (char*)(((size_t)start + size) & ~(page - 1));
+  if (lo < hi && madvise(lo, hi - lo, MADV_DONTNEED) == 0) {
+    return hi - lo;
+  }
+#else
+  (void)start;
+  (void)size;
+#endif
+  return 0;
+}
+
+/*
+ * mem_trim - shrinks the heap by decr bytes and returns the old break, like
+ *    sbrk with a negative increment. With MEM_MMAP, the pages past the new
+ *    break are given back to the system, so they count as never handed out
+ *    again. The simulated heap keeps its memory, which stays dirty.
+ */
+void* mem_trim(size_t decr) {
+  if (decr > (size_t)(mem_brk - mem_start_brk)) {
+    errno = EINVAL;
+    return (void*)-1;
+  }
+  char* old_brk = mem_brk;
+  mem_brk -= decr;
+#if MEM_MMAP
+  size_t page = mem_pagesize();
+  char* lo = (char*)(((size_t)mem_brk + page - 1) & ~(page - 1));
+  char* hi = (char*)(((size_t)mem_fresh + page - 1) & ~(page - 1));
+  if (lo < hi && mem_release(lo, hi - lo) == (size_t)(hi - lo)) {
+    mem_fresh = lo;
+  }
+#endif
+  return (void*)old_brk;
+}
+
+/*
+ * mem_fresh_lo - returns the first byte that mem_sbrk has not handed out
+ *    since mem_init. Every byte from there to the end of the storage is
+ *    still zero, even after mem_reset_brk.
+ */
+void* mem_fresh_lo(void) { return (void*)mem_fresh; }
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -101,6 +216,53 @@ void* mem_heap_hi(void) { return (void*)(mem_brk - 1); }
  */
 size_t mem_heapsize(void) { return (size_t)(mem_brk - mem_start_brk); }
 
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes since the
+ *    last mem_reset_brk
+ */
+size_t mem_peak_heapsize(void) {
+  return (size_t)(mem_peak_brk - mem_start_brk);
+}
+
+/*
+ * mem_committed() - returns the number of bytes of the heap's storage that
+ *    hold memory. The simulated heap allocates all of it up front.
+ */
+size_t mem_committed(void) {
+#if MEM_MMAP
+  return (size_t)(mem_commit - mem_start_brk);
+#else
+  return MAX_HEAP;
+#endif
+}
+
+/*
+ * mem_resident() - returns the number of bytes of the heap that sit in
+ *    physical memory, counted in whole pages. Returns 0 if the system
+ *    cannot tell.
+ */
+size_t mem_resident(void) {
+  size_t page = mem_pagesize();
+  char* lo = (char*)((size_t)mem_start_brk & ~(page - 1));
+  char* hi = (char*)(((size_t)mem_brk + page - 1) & ~(page - 1));
+  size_t pages = (size_t)(hi - lo) / page;
+  unsigned char* vec = malloc(pages + 1);
+  size_t resident = 0;
+  if (vec != NULL && mincore(lo, hi - lo, vec) == 0) {
+    for (size_t i = 0; i < pages; i++) {
+      resident += vec[i] & 1;
+    }
+  }
+  free(vec);
+  return resident * page;
+}
+
+/*
+ * mem_reserved() - returns the number of bytes of address space that the
+ *    heap may grow into
+ */
+size_t mem_reserved(void) { return (size_t)(mem_max_addr - mem_start_brk); }
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -27,11 +27,18 @@
 
 void mem_init(void);
 void mem_deinit(void);
-void* mem_sbrk(unsigned int incr);
+void* mem_sbrk(size_t incr);
+void* mem_trim(size_t decr);
+size_t mem_release(void* start, size_t size);
+void* mem_fresh_lo(void);
 void mem_reset_brk(void);
 void* mem_heap_lo(void);
 void* mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_committed(void);
+size_t mem_resident(void);
+size_t mem_reserved(void);
 size_t mem_pagesize(void);
 
 #endif  // MM_MEMLIB_H
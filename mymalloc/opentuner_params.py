@@ -1,6 +1,8 @@
 #!/usr/bin/env python
 #
 from opentuner import ConfigurationManipulator
+from opentuner.search.manipulator import EnumParameter
+from opentuner.search.manipulator import IntegerParameter
 from opentuner.search.manipulator import PowerOfTwoParameter
 
 mdriver_manipulator = ConfigurationManipulator()
@@ -13,3 +15,31 @@ TODO(project3): Implement the parameters of your allocator. Once
 you have at least one other parameters, feel free to remove ALIGNMENT.
 """
 mdriver_manipulator.add_parameter(PowerOfTwoParameter('ALIGNMENT', 8, 8))
+
+# Bin layout: 0 = power-of-two bins, 1 = two-level segregated fit
+mdriver_manipulator.add_parameter(IntegerParameter('TLSF', 0, 1))
+mdriver_manipulator.add_parameter(IntegerParameter('TLSF_SL_LOG2', 3, 4))
+mdriver_manipulator.add_parameter(EnumParameter('TLSF_FIT_LIMIT', [1, 2, 4, 8, 16, 64]))
+
+# Slab runs for tiny objects: largest slab size class (0 disables) and run size
+mdriver_manipulator.add_parameter(EnumParameter('SLAB_MAX_SIZE', [0, 16, 32, 48, 64]))
+mdriver_manipulator.add_parameter(PowerOfTwoParameter('SLAB_RUN_SIZE', 512, 4096))
+
+# Deferred coalescing: largest block kept on the quick lists (0 disables) and
+# how many deferred blocks trigger a consolidation
+mdriver_manipulator.add_parameter(EnumParameter('QUICK_MAX_SIZE', [0, 64, 128, 256]))
+mdriver_manipulator.add_parameter(PowerOfTwoParameter('QUICK_LIMIT', 16, 1024))
+
+# Smallest free block kept in the best-fit tree instead of the bins (0 disables)
+mdriver_manipulator.add_parameter(EnumParameter('TREE_MIN_SIZE', [0, 256, 512, 1024, 2048, 4096, 8192]))
+
+# Extra room, in percent, given to a block that realloc grows repeatedly (0 disables)
+mdriver_manipulator.add_parameter(EnumParameter('REALLOC_HEADROOM', [0, 25, 50, 100, 200]))
+
+# Smallest block realloc moves with streaming stores (0 disables)
+mdriver_manipulator.add_parameter(EnumParameter('STREAM_COPY_MIN_SIZE', [0, 262144, 1048576, 4194304]))
+
+# Heap growth: page size the heap grows in, and extra growth in percent of
+# the heap size, capped at the last growth (0 grows by what is missing)
+mdriver_manipulator.add_parameter(PowerOfTwoParameter('TOP_PAGE_SIZE', 8, 4096))
+mdriver_manipulator.add_parameter(EnumParameter('TOP_PAD_PERCENT', [0, 1, 3, 6, 12, 25]))
@@ -136,6 +136,7 @@ int eval_mm_valid(const malloc_impl_t* impl, trace_t* trace, int tracenum) {
   int i = 0;
   int index = 0;
   int size = 0;
+  size_t usable = 0;
   int oldsize = 0;
   char* newp = NULL;
   char* oldp = NULL;
@@ -157,25 +158,50 @@ int eval_mm_valid(const malloc_impl_t* impl, trace_t* trace, int tracenum) {
     size = trace->ops[i].size;
 
     switch (trace->ops[i].type) {
-      case ALLOC:  // malloc
-
-        // Call the student's malloc
-        if ((p = (char*)impl->malloc(size)) == NULL) {
+      case ALLOC:          // malloc
+      case ALIGNED_ALLOC:  // memalign
+
+        // Call the student's malloc or memalign
+        if (trace->ops[i].type == ALLOC) {
+          p = (char*)impl->malloc_sized(size, &usable);
+        } else {
+          p = (char*)impl->memalign(trace->ops[i].alignment, size);
+        }
+        if (p == NULL) {
           malloc_error(tracenum, i, "impl malloc failed.");
           return 0;
         }
+        if (trace->ops[i].type == ALIGNED_ALLOC) {
+          usable = impl->usable_size(p);
+        }
+
+        // The reported capacity must hold the request and agree with
+        // usable_size
+        if (usable < (size_t)size || usable != impl->usable_size(p)) {
+          printf("Error: %p reports %zu usable bytes for %d\n", p, usable,
+                 size);
+          return 0;
+        }
+
+        // An aligned block must also honor the requested alignment
+        if (trace->ops[i].type == ALIGNED_ALLOC &&
+            (uint64_t)p % trace->ops[i].alignment != 0) {
+          printf("Error: %p not aligned to %d\n", p, trace->ops[i].alignment);
+          return 0;
+        }
 
         // Test the range of the new block for correctness and add it
         // to the range list if OK. The block must be  be aligned properly,
-        // and must not overlap any currently allocated block.
-        if (add_range(impl, &ranges, p, size, tracenum, i) == 0) {
+        // and must not overlap any currently allocated block, including
+        // the slack it reports.
+        if (add_range(impl, &ranges, p, usable, tracenum, i) == 0) {
           printf("when trying to add trace %d with size %d \n", i, size);
           return 0;
         }
 
         // Fill the allocated region with some unique data that you can check
         // for if the region is copied via realloc.
-        for (int i = 0; i < size; ++i) 
+        for (int i = 0; i < (int)usable; ++i)
           *(p + i) = i%128;
         
         // print_mem(p, size);
@@ -197,7 +223,13 @@ int eval_mm_valid(const malloc_impl_t* impl, trace_t* trace, int tracenum) {
         remove_range(&ranges, oldp);
 
         // Check new block for correctness and add it to range list
-        if (add_range(impl, &ranges, newp, size, tracenum, i) == 0) {
+        usable = impl->usable_size(newp);
+        if (usable < (size_t)size) {
+          printf("Error: %p reports %zu usable bytes for %d\n", newp, usable,
+                 size);
+          return 0;
+        }
+        if (add_range(impl, &ranges, newp, usable, tracenum, i) == 0) {
           return 0;
         }
 
@@ -217,7 +249,7 @@ int eval_mm_valid(const malloc_impl_t* impl, trace_t* trace, int tracenum) {
            }
         }
 
-        for (int i = 0; i < size; ++i)
+        for (int i = 0; i < (int)usable; ++i)
             *(newp + i) = i%128;
 
         // Remember region
@@ -227,10 +259,16 @@ int eval_mm_valid(const malloc_impl_t* impl, trace_t* trace, int tracenum) {
 
       case FREE:  // free
 
-        // Remove region from list and call student's free function
+        // Remove region from list and call student's free function. Every
+        // other block is freed with the size it was last allocated for, so
+        // both free paths are checked.
         p = trace->blocks[index];
         remove_range(&ranges, p);
-        impl->free(p);
+        if (index % 2) {
+          impl->free_sized(p, trace->block_sizes[index]);
+        } else {
+          impl->free(p);
+        }
         break;
 
       case WRITE:  // write